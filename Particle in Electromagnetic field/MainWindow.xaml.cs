@@ -3434,6 +3434,18 @@ namespace Particle_in_Electromagnetic_field
                 if (File.Exists(GeometryFilePath))
                     File.Delete(GeometryFilePath);
 
+                string SurfaceFilePath = System.IO.Path.Combine(helpersDir, "geometry_surface.bin");
+                if (File.Exists(SurfaceFilePath))
+                    File.Delete(SurfaceFilePath);
+
+                string FieldFilePath = System.IO.Path.Combine(helpersDir, "efield.npy");
+                if (File.Exists(FieldFilePath))
+                    File.Delete(FieldFilePath);
+
+                string CurvesFilePath = System.IO.Path.Combine(helpersDir, "traced_curves.bin");
+                if (File.Exists(CurvesFilePath))
+                    File.Delete(CurvesFilePath);
+
                 var trajectoryFiles = Directory.GetFiles(helpersDir, "particle_track_*.txt");
                 foreach (string file in trajectoryFiles)
                 {
@@ -3497,6 +3509,18 @@ namespace Particle_in_Electromagnetic_field
                 if (File.Exists(GeometryFilePath))
                     File.Delete(GeometryFilePath);
 
+                string SurfaceFilePath = System.IO.Path.Combine(helpersDir, "geometry_surface.bin");
+                if (File.Exists(SurfaceFilePath))
+                    File.Delete(SurfaceFilePath);
+
+                string FieldFilePath = System.IO.Path.Combine(helpersDir, "efield.npy");
+                if (File.Exists(FieldFilePath))
+                    File.Delete(FieldFilePath);
+
+                string CurvesFilePath = System.IO.Path.Combine(helpersDir, "traced_curves.bin");
+                if (File.Exists(CurvesFilePath))
+                    File.Delete(CurvesFilePath);
+
                 var trajectoryFiles = Directory.GetFiles(helpersDir, "particle_track_*.txt");
                 foreach (string file in trajectoryFiles)
                 {
@@ -9,7 +9,7 @@ The E field is defined by the potentials on several electrodes in the system. He
 B field (Bx, By, Bz) as the global variable. Then in the main funciton we define the simulation box as a 3d box with
 given sides and resolution. The electrodeds can take the shapes like plate (capacitor), sphere, cylinder, hyperboloide,
 ellipsoid, hollow pipe, or rectangular box. And combination of them that gives a valid boundary condition is also allowed.
-Arbitrary shapes are not possible in this scope.
+Arbitrary shapes can be imported as closed triangle meshes (STL or OBJ files, electrode type "Mesh").
 
 The simulator solves the Laplace equation numerically over the grid points and. The test particle (or multiparticles) can
 be injected into the system with initial position and velocity. The function named propagator(particle) uses boris pusher
@@ -28,7 +28,13 @@ to a temporary python __main__ for easier visualization. The python package Maya
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
 #include "json.hpp"
+#include "simulation_box.hpp"
 // #include "C:\\Users\\mrsag\\AppData\\Local\\Programs\\Python\\Python311\\include\\Python.h"
 
 using namespace std;
@@ -38,8 +44,6 @@ namespace fs = std::filesystem;
 
 double Bx, By, Bz;
 
-double cm = 1e-2;
-double mm = 1e-3;
 double qe = 1.60217663e-19;
 double me = 9.10938e-31;
 double mH = 1.67262192e-27;
@@ -47,683 +51,6 @@ double c = 3e8;
 
 double kev_to_joule = 1.660217663e-16;
 
-/*
-//////////////////////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-                                3D SIMULATION BOX OBJECT FOR MAIN GEOMETRY
-
-//////////////////////////////////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////////////////////////////////
-*/
-
-class SimulationBox3D
-{
-public:
-    int nx, ny, nz;
-    double lx, ly, lz;
-    double dx, dy, dz;
-
-    SimulationBox3D(int nx, int ny, int nz,
-                    double lx, double ly, double lz,
-                    double potential_offset = 0.0);
-
-    void addSphere(double cx, double cy, double cz, double radius, double potential_value);
-    void addBox(double x0, double y0, double z0,
-                double x1, double y1, double z1, double potential_value);
-
-    void addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value);
-    void addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value);
-    void addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value);
-    void addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value);
-    void addPlane(double A, double B, double C, double D, double thickness, double potential_value);
-
-    void solve(int max_iter = 1000, double tol = 1e-4, const std::string &method = "jacobi");
-
-    // Add geometry will be added next (e.g., addBox, addSphere)
-
-    const std::vector<double> &getPotential() const { return potential; }
-
-    std::vector<double> potential;
-    std::vector<double> geometry;
-    std::vector<bool> fixed_mask;
-
-    int index(int i, int j, int k) const
-    {
-        return i * ny * nz + j * nz + k;
-    }
-
-    void applyJacobi();
-    void applyGaussSeidel();
-};
-
-SimulationBox3D::SimulationBox3D(int nx, int ny, int nz,
-                                 double lx, double ly, double lz,
-                                 double potential_offset)
-    : nx(nx), ny(ny), nz(nz), lx(lx), ly(ly), lz(lz)
-{
-    dx = lx / (nx - 1);
-    dy = ly / (ny - 1);
-    dz = lz / (nz - 1);
-
-    int total_size = nx * ny * nz;
-    potential.resize(total_size, potential_offset);
-    geometry = potential;
-    fixed_mask.resize(total_size, false);
-}
-
-void SimulationBox3D::solve(int max_iter, double tol, const std::string &method)
-{
-    std::vector<double> V_old = potential;
-    std::vector<double> V_new = potential;
-
-    for (int iter = 0; iter < max_iter; ++iter)
-    {
-        V_old = potential;
-
-        if (method == "jacobi")
-        {
-            applyJacobi();
-        }
-        else if (method == "gauss-seidel")
-        {
-            applyGaussSeidel();
-        }
-        else
-        {
-            throw std::runtime_error("Unknown method");
-        }
-
-        // Check for convergence
-        double max_diff = 0.0;
-        for (size_t i = 0; i < potential.size(); ++i)
-        {
-            max_diff = std::max(max_diff, std::abs(potential[i] - V_old[i]));
-        }
-
-        std::cout << "Iteration " << iter << ", Max Diff = " << max_diff << std::endl;
-
-        if (max_diff <= tol)
-        {
-            std::cout << "Converged at iteration " << iter << std::endl;
-            break;
-        }
-    }
-}
-
-void SimulationBox3D::addSphere(double cx, double cy, double cz, double radius, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double dist = std::sqrt((x - cx) * (x - cx) +
-                                        (y - cy) * (y - cy) +
-                                        (z - cz) * (z - cz));
-                if (dist <= radius)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addBox(double x0, double y0, double z0,
-                             double x1, double y1, double z1, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        if (x < x0 || x > x1)
-            continue;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            if (y < y0 || y > y1)
-                continue;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                if (z < z0 || z > z1)
-                    continue;
-
-                int idx = index(i, j, k);
-                potential[idx] = potential_value;
-                geometry[idx] = potential_value;
-                fixed_mask[idx] = true;
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-
-                bool inside = false;
-                if (axis == 'z')
-                {
-                    double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
-                    inside = (r2 <= radius * radius && z >= cz && z <= cz + height);
-                }
-                else if (axis == 'x')
-                {
-                    double r2 = (y - cy) * (y - cy) + (z - cz) * (z - cz);
-                    inside = (r2 <= radius * radius && x >= cx && x <= cx + height);
-                }
-                else if (axis == 'y')
-                {
-                    double r2 = (x - cx) * (x - cx) + (z - cz) * (z - cz);
-                    inside = (r2 <= radius * radius && y >= cy && y <= cy + height);
-                }
-
-                if (inside)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value)
-{
-    double r_outer2 = (radius + thickness / 2.0) * (radius + thickness / 2.0);
-    double r_inner2 = (radius - thickness / 2.0) * (radius - thickness / 2.0);
-
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-
-                bool inside = false;
-                if (axis == 'z')
-                {
-                    double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && z >= cz && z <= cz + height);
-                }
-                else if (axis == 'x')
-                {
-                    double r2 = (y - cy) * (y - cy) + (z - cz) * (z - cz);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && x >= cx && x <= cx + height);
-                }
-                else if (axis == 'y')
-                {
-                    double r2 = (x - cx) * (x - cx) + (z - cz) * (z - cz);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && y >= cy && y <= cy + height);
-                }
-
-                if (inside)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double value = ((x - cx) / rx) * ((x - cx) / rx) + ((y - cy) / ry) * ((y - cy) / ry) + ((z - cz) / rz) * ((z - cz) / rz);
-                if (value <= 1.0)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double val = 0.0;
-                if (axis == 'x')
-                {
-                    val = -((x - cx) / a) * ((x - cx) / a) + ((y - cy) / b) * ((y - cy) / b) + ((z - cz) / c) * ((z - cz) / c);
-                }
-                else if (axis == 'y')
-                {
-                    val = ((x - cx) / a) * ((x - cx) / a) - ((y - cy) / b) * ((y - cy) / b) + ((z - cz) / c) * ((z - cz) / c);
-                }
-                else if (axis == 'z')
-                {
-                    val = ((x - cx) / a) * ((x - cx) / a) + ((y - cy) / b) * ((y - cy) / b) - ((z - cz) / c) * ((z - cz) / c);
-                }
-
-                if (val <= waist * waist)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::addPlane(double A, double B, double C, double D, double thickness, double potential_value)
-{
-    double norm = std::sqrt(A * A + B * B + C * C);
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double dist = (A * x + B * y + C * z + D) / norm;
-                if (std::abs(dist) <= thickness / 2.0)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
-
-void SimulationBox3D::applyJacobi()
-{
-    std::vector<double> new_potential = potential;
-
-    // Interior points
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int j = 1; j < ny - 1; ++j)
-        {
-            for (int k = 1; k < nz - 1; ++k)
-            {
-                int idx = index(i, j, k);
-                if (!fixed_mask[idx])
-                {
-                    new_potential[idx] = (1.0 / 6.0) * (potential[index(i + 1, j, k)] + potential[index(i - 1, j, k)] +
-                                                        potential[index(i, j + 1, k)] + potential[index(i, j - 1, k)] +
-                                                        potential[index(i, j, k + 1)] + potential[index(i, j, k - 1)]);
-                }
-            }
-        }
-    }
-
-    // Face points
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(0, j, k);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(1, j, k)] + potential[index(0, j + 1, k)] +
-                                                    potential[index(0, j - 1, k)] + potential[index(0, j, k + 1)] +
-                                                    potential[index(0, j, k - 1)]);
-
-            int idx1 = index(nx - 1, j, k);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(nx - 2, j, k)] + potential[index(nx - 1, j + 1, k)] +
-                                                     potential[index(nx - 1, j - 1, k)] + potential[index(nx - 1, j, k + 1)] +
-                                                     potential[index(nx - 1, j, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(i, 0, k);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, 0, k)] + potential[index(i - 1, 0, k)] +
-                                                    potential[index(i, 1, k)] + potential[index(i, 0, k + 1)] +
-                                                    potential[index(i, 0, k - 1)]);
-
-            int idx1 = index(i, ny - 1, k);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, ny - 1, k)] + potential[index(i - 1, ny - 1, k)] +
-                                                     potential[index(i, ny - 2, k)] + potential[index(i, ny - 1, k + 1)] +
-                                                     potential[index(i, ny - 1, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int j = 1; j < ny - 1; ++j)
-        {
-            int idx = index(i, j, 0);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, j, 0)] + potential[index(i - 1, j, 0)] +
-                                                    potential[index(i, j + 1, 0)] + potential[index(i, j - 1, 0)] +
-                                                    potential[index(i, j, 1)]);
-
-            int idx1 = index(i, j, nz - 1);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, j, nz - 1)] + potential[index(i - 1, j, nz - 1)] +
-                                                     potential[index(i, j + 1, nz - 1)] + potential[index(i, j - 1, nz - 1)] +
-                                                     potential[index(i, j, nz - 2)]);
-        }
-    }
-
-    // Edge points (4 neighbors)
-    for (int k = 1; k < nz - 1; ++k)
-    {
-        int idx = index(0, 0, k);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(1, 0, k)] + potential[index(0, 1, k)] +
-                                                potential[index(0, 0, k + 1)] + potential[index(0, 0, k - 1)]);
-
-        int idx1 = index(0, ny - 1, k);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(1, ny - 1, k)] + potential[index(0, ny - 2, k)] +
-                                                 potential[index(0, ny - 1, k + 1)] + potential[index(0, ny - 1, k - 1)]);
-
-        int idx2 = index(nx - 1, 0, k);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(nx - 2, 0, k)] + potential[index(nx - 1, 1, k)] +
-                                                 potential[index(nx - 1, 0, k + 1)] + potential[index(nx - 1, 0, k - 1)]);
-
-        int idx3 = index(nx - 1, ny - 1, k);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, ny - 1, k)] + potential[index(nx - 1, ny - 2, k)] +
-                                                 potential[index(nx - 1, ny - 1, k + 1)] + potential[index(nx - 1, ny - 1, k - 1)]);
-    }
-
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        int idx = index(0, j, 0);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(1, j, 0)] + potential[index(0, j + 1, 0)] +
-                                                potential[index(0, j - 1, 0)] + potential[index(0, j, 1)]);
-
-        int idx1 = index(nx - 1, j, 0);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(nx - 2, j, 0)] + potential[index(nx - 1, j + 1, 0)] +
-                                                 potential[index(nx - 1, j - 1, 0)] + potential[index(nx - 1, j, 1)]);
-
-        int idx2 = index(0, j, nz - 1);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(1, j, nz - 1)] + potential[index(0, j + 1, nz - 1)] +
-                                                 potential[index(0, j - 1, nz - 1)] + potential[index(0, j, nz - 2)]);
-
-        int idx3 = index(nx - 1, j, nz - 1);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, j, nz - 1)] + potential[index(nx - 1, j + 1, nz - 1)] +
-                                                 potential[index(nx - 1, j - 1, nz - 1)] + potential[index(nx - 1, j, nz - 2)]);
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        int idx = index(i, 0, 0);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(i + 1, 0, 0)] + potential[index(i - 1, 0, 0)] +
-                                                potential[index(i, 1, 0)] + potential[index(i, 0, 1)]);
-
-        int idx1 = index(i, ny - 1, 0);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, 0)] + potential[index(i - 1, ny - 1, 0)] +
-                                                 potential[index(i, ny - 2, 0)] + potential[index(i, ny - 1, 1)]);
-
-        int idx2 = index(i, 0, nz - 1);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(i + 1, 0, nz - 1)] + potential[index(i - 1, 0, nz - 1)] +
-                                                 potential[index(i, 1, nz - 1)] + potential[index(i, 0, nz - 2)]);
-
-        int idx3 = index(i, ny - 1, nz - 1);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, nz - 1)] + potential[index(i - 1, ny - 1, nz - 1)] +
-                                                 potential[index(i, ny - 2, nz - 1)] + potential[index(i, ny - 1, nz - 2)]);
-    }
-
-    // Corner points (3 neighbors)
-    if (!fixed_mask[index(0, 0, 0)])
-        new_potential[index(0, 0, 0)] = (1.0 / 3.0) * (potential[index(1, 0, 0)] + potential[index(0, 1, 0)] + potential[index(0, 0, 1)]);
-
-    if (!fixed_mask[index(nx - 1, 0, 0)])
-        new_potential[index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, 0)] + potential[index(nx - 1, 1, 0)] + potential[index(nx - 1, 0, 1)]);
-
-    if (!fixed_mask[index(0, ny - 1, 0)])
-        new_potential[index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(1, ny - 1, 0)] + potential[index(0, ny - 2, 0)] + potential[index(0, ny - 1, 1)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, 0)])
-        new_potential[index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, 0)] + potential[index(nx - 1, ny - 2, 0)] + potential[index(nx - 1, ny - 1, 1)]);
-
-    if (!fixed_mask[index(0, 0, nz - 1)])
-        new_potential[index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(1, 0, nz - 1)] + potential[index(0, 1, nz - 1)] + potential[index(0, 0, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, 0, nz - 1)])
-        new_potential[index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, nz - 1)] + potential[index(nx - 1, 1, nz - 1)] + potential[index(nx - 1, 0, nz - 2)]);
-
-    if (!fixed_mask[index(0, ny - 1, nz - 1)])
-        new_potential[index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(1, ny - 1, nz - 1)] + potential[index(0, ny - 2, nz - 1)] + potential[index(0, ny - 1, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, nz - 1)])
-        new_potential[index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, nz - 1)] + potential[index(nx - 1, ny - 2, nz - 1)] + potential[index(nx - 1, ny - 1, nz - 2)]);
-
-    // Final update
-    potential = std::move(new_potential);
-}
-
-void SimulationBox3D::applyGaussSeidel()
-{
-    // Interior points
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int j = 1; j < ny - 1; ++j)
-        {
-            for (int k = 1; k < nz - 1; ++k)
-            {
-                int idx = index(i, j, k);
-                if (!fixed_mask[idx])
-                {
-                    potential[idx] = (1.0 / 6.0) * (potential[index(i + 1, j, k)] + potential[index(i - 1, j, k)] +
-                                                    potential[index(i, j + 1, k)] + potential[index(i, j - 1, k)] +
-                                                    potential[index(i, j, k + 1)] + potential[index(i, j, k - 1)]);
-                }
-            }
-        }
-    }
-
-    // Face points (excluding edges and corners)
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(0, j, k);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(1, j, k)] + potential[index(0, j + 1, k)] +
-                                                potential[index(0, j - 1, k)] + potential[index(0, j, k + 1)] +
-                                                potential[index(0, j, k - 1)]);
-
-            int idx1 = index(nx - 1, j, k);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(nx - 2, j, k)] + potential[index(nx - 1, j + 1, k)] +
-                                                 potential[index(nx - 1, j - 1, k)] + potential[index(nx - 1, j, k + 1)] +
-                                                 potential[index(nx - 1, j, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(i, 0, k);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, 0, k)] + potential[index(i - 1, 0, k)] +
-                                                potential[index(i, 1, k)] + potential[index(i, 0, k + 1)] +
-                                                potential[index(i, 0, k - 1)]);
-
-            int idx1 = index(i, ny - 1, k);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, ny - 1, k)] + potential[index(i - 1, ny - 1, k)] +
-                                                 potential[index(i, ny - 2, k)] + potential[index(i, ny - 1, k + 1)] +
-                                                 potential[index(i, ny - 1, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int j = 1; j < ny - 1; ++j)
-        {
-            int idx = index(i, j, 0);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, j, 0)] + potential[index(i - 1, j, 0)] +
-                                                potential[index(i, j + 1, 0)] + potential[index(i, j - 1, 0)] +
-                                                potential[index(i, j, 1)]);
-
-            int idx1 = index(i, j, nz - 1);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, j, nz - 1)] + potential[index(i - 1, j, nz - 1)] +
-                                                 potential[index(i, j + 1, nz - 1)] + potential[index(i, j - 1, nz - 1)] +
-                                                 potential[index(i, j, nz - 2)]);
-        }
-    }
-
-    // Edge points (4 neighbors)
-    for (int k = 1; k < nz - 1; ++k)
-    {
-        // x edges at y=0 and y=ny-1
-        int idx = index(0, 0, k);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(1, 0, k)] + potential[index(0, 1, k)] +
-                                            potential[index(0, 0, k + 1)] + potential[index(0, 0, k - 1)]);
-
-        int idx1 = index(0, ny - 1, k);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(1, ny - 1, k)] + potential[index(0, ny - 2, k)] +
-                                             potential[index(0, ny - 1, k + 1)] + potential[index(0, ny - 1, k - 1)]);
-
-        int idx2 = index(nx - 1, 0, k);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(nx - 2, 0, k)] + potential[index(nx - 1, 1, k)] +
-                                             potential[index(nx - 1, 0, k + 1)] + potential[index(nx - 1, 0, k - 1)]);
-
-        int idx3 = index(nx - 1, ny - 1, k);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, ny - 1, k)] + potential[index(nx - 1, ny - 2, k)] +
-                                             potential[index(nx - 1, ny - 1, k + 1)] + potential[index(nx - 1, ny - 1, k - 1)]);
-    }
-
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        int idx = index(0, j, 0);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(1, j, 0)] + potential[index(0, j + 1, 0)] +
-                                            potential[index(0, j - 1, 0)] + potential[index(0, j, 1)]);
-
-        int idx1 = index(nx - 1, j, 0);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(nx - 2, j, 0)] + potential[index(nx - 1, j + 1, 0)] +
-                                             potential[index(nx - 1, j - 1, 0)] + potential[index(nx - 1, j, 1)]);
-
-        int idx2 = index(0, j, nz - 1);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(1, j, nz - 1)] + potential[index(0, j + 1, nz - 1)] +
-                                             potential[index(0, j - 1, nz - 1)] + potential[index(0, j, nz - 2)]);
-
-        int idx3 = index(nx - 1, j, nz - 1);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, j, nz - 1)] + potential[index(nx - 1, j + 1, nz - 1)] +
-                                             potential[index(nx - 1, j - 1, nz - 1)] + potential[index(nx - 1, j, nz - 2)]);
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        int idx = index(i, 0, 0);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(i + 1, 0, 0)] + potential[index(i - 1, 0, 0)] +
-                                            potential[index(i, 1, 0)] + potential[index(i, 0, 1)]);
-
-        int idx1 = index(i, ny - 1, 0);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, 0)] + potential[index(i - 1, ny - 1, 0)] +
-                                             potential[index(i, ny - 2, 0)] + potential[index(i, ny - 1, 1)]);
-
-        int idx2 = index(i, 0, nz - 1);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(i + 1, 0, nz - 1)] + potential[index(i - 1, 0, nz - 1)] +
-                                             potential[index(i, 1, nz - 1)] + potential[index(i, 0, nz - 2)]);
-
-        int idx3 = index(i, ny - 1, nz - 1);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, nz - 1)] + potential[index(i - 1, ny - 1, nz - 1)] +
-                                             potential[index(i, ny - 2, nz - 1)] + potential[index(i, ny - 1, nz - 2)]);
-    }
-
-    // Corners (3 neighbors)
-    if (!fixed_mask[index(0, 0, 0)])
-        potential[index(0, 0, 0)] = (1.0 / 3.0) * (potential[index(1, 0, 0)] + potential[index(0, 1, 0)] + potential[index(0, 0, 1)]);
-
-    if (!fixed_mask[index(nx - 1, 0, 0)])
-        potential[index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, 0)] + potential[index(nx - 1, 1, 0)] + potential[index(nx - 1, 0, 1)]);
-
-    if (!fixed_mask[index(0, ny - 1, 0)])
-        potential[index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(1, ny - 1, 0)] + potential[index(0, ny - 2, 0)] + potential[index(0, ny - 1, 1)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, 0)])
-        potential[index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, 0)] + potential[index(nx - 1, ny - 2, 0)] + potential[index(nx - 1, ny - 1, 1)]);
-
-    if (!fixed_mask[index(0, 0, nz - 1)])
-        potential[index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(1, 0, nz - 1)] + potential[index(0, 1, nz - 1)] + potential[index(0, 0, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, 0, nz - 1)])
-        potential[index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, nz - 1)] + potential[index(nx - 1, 1, nz - 1)] + potential[index(nx - 1, 0, nz - 2)]);
-
-    if (!fixed_mask[index(0, ny - 1, nz - 1)])
-        potential[index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(1, ny - 1, nz - 1)] + potential[index(0, ny - 2, nz - 1)] + potential[index(0, ny - 1, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, nz - 1)])
-        potential[index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, nz - 1)] + potential[index(nx - 1, ny - 2, nz - 1)] + potential[index(nx - 1, ny - 1, nz - 2)]);
-}
-
 /*
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1050,6 +377,163 @@ std::tuple<double, double, double> normalize_vector(double vx, double vy, double
     return {vx / norm, vy / norm, vz / norm};
 }
 
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        SURFACE PREVIEW
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// geometry_surface.bin: one record of 10 little-endian float32 per triangle, the three vertices
+// (x, y, z in m) followed by the potential of the electrode it bounds
+const std::string geometry_surface_file = "geometry_surface.bin";
+
+// Marching tetrahedra over the electrode cells: every grid cube is split into the 6 tetrahedra
+// around its main diagonal and each tetrahedron with inside and outside corners contributes one or
+// two triangles. The vertex on an edge is found by bisecting the inside corner's electrode, so the
+// surface follows the true shape rather than the staircase.
+std::vector<float> extract_electrode_surface(const SimulationBox3D &box)
+{
+    // corner c of a cube is (i + (c & 1), j + (c >> 1 & 1), k + (c >> 2 & 1))
+    const int tetrahedra[6][4] = {{0, 1, 3, 7}, {0, 1, 5, 7}, {0, 2, 3, 7}, {0, 2, 6, 7}, {0, 4, 5, 7}, {0, 4, 6, 7}};
+
+    // when a symmetry plane falls between two nodes, the cubes reaching across it (onto the mirrored
+    // ghost nodes) close the gap to the reflected half; they are symmetric already and not reflected
+    int i_end = box.nx - 1 + (box.mirror_x && box.full_nx % 2 == 0);
+    int j_end = box.ny - 1 + (box.mirror_y && box.full_ny % 2 == 0);
+
+    std::vector<std::vector<float>> slab_triangles(box.nx);
+    std::vector<std::vector<unsigned char>> slab_straddles(box.nx); // per triangle: bit 0 across x, bit 1 across y
+    parallel_for(0, i_end, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+        {
+            std::vector<float> &out = slab_triangles[i];
+            for (int j = 0; j < j_end; ++j)
+                for (int k = 0; k + 1 < box.nz; ++k)
+                {
+                    unsigned char straddle = (i + 1 == box.nx) | (j + 1 == box.ny) << 1;
+                    std::array<std::array<double, 3>, 8> position;
+                    std::array<int, 8> label;
+                    std::array<double, 8> value;
+                    int inside_count = 0;
+                    for (int c = 0; c < 8; ++c)
+                    {
+                        int ii = i + (c & 1), jj = j + (c >> 1 & 1), kk = k + (c >> 2 & 1);
+                        position[c] = {ii * box.dx, jj * box.dy, kk * box.dz};
+                        box.neighbourCell(ii, jj, kk);
+                        int idx = box.index(ii, jj, kk);
+                        label[c] = box.fixed_mask[idx] ? box.label[idx] : -1;
+                        value[c] = box.geometry[idx];
+                        inside_count += label[c] >= 0;
+                    }
+                    if (inside_count == 0 || inside_count == 8)
+                        continue;
+
+                    // surface point on the edge from an inside corner a to an outside corner b
+                    auto edge_point = [&](int a, int b)
+                    {
+                        std::array<double, 3> in = position[a], out_point = position[b];
+                        if (label[a] > 0 && static_cast<size_t>(label[a]) <= box.shapes.size())
+                        {
+                            const Electrode &e = box.shapes[label[a] - 1];
+                            for (int iter = 0; iter < 8; ++iter)
+                            {
+                                std::array<double, 3> mid = {0.5 * (in[0] + out_point[0]), 0.5 * (in[1] + out_point[1]), 0.5 * (in[2] + out_point[2])};
+                                if (e.contains(mid[0], mid[1], mid[2]))
+                                    in = mid;
+                                else
+                                    out_point = mid;
+                            }
+                        }
+                        return std::array<double, 3>{0.5 * (in[0] + out_point[0]), 0.5 * (in[1] + out_point[1]), 0.5 * (in[2] + out_point[2])};
+                    };
+                    auto emit = [&](const std::array<double, 3> &p0, const std::array<double, 3> &p1,
+                                    const std::array<double, 3> &p2, double value)
+                    {
+                        for (const auto *p : {&p0, &p1, &p2})
+                            for (int d = 0; d < 3; ++d)
+                                out.push_back(static_cast<float>((*p)[d]));
+                        out.push_back(static_cast<float>(value));
+                        slab_straddles[i].push_back(straddle);
+                    };
+
+                    for (const auto &t : tetrahedra)
+                    {
+                        int in[4], out_corners[4], n_in = 0, n_out = 0;
+                        for (int c : t)
+                        {
+                            if (label[c] >= 0)
+                                in[n_in++] = c;
+                            else
+                                out_corners[n_out++] = c;
+                        }
+                        if (n_in == 0 || n_out == 0)
+                            continue;
+
+                        if (n_in == 1)
+                            emit(edge_point(in[0], out_corners[0]), edge_point(in[0], out_corners[1]),
+                                 edge_point(in[0], out_corners[2]), value[in[0]]);
+                        else if (n_out == 1)
+                            emit(edge_point(in[0], out_corners[0]), edge_point(in[1], out_corners[0]),
+                                 edge_point(in[2], out_corners[0]), value[in[0]]);
+                        else
+                        {
+                            // two in, two out: the section is a quad
+                            std::array<double, 3> p00 = edge_point(in[0], out_corners[0]), p01 = edge_point(in[0], out_corners[1]);
+                            std::array<double, 3> p11 = edge_point(in[1], out_corners[1]), p10 = edge_point(in[1], out_corners[0]);
+                            emit(p00, p01, p11, value[in[0]]);
+                            emit(p00, p11, p10, value[in[1]]);
+                        }
+                    }
+                }
+        }
+    });
+
+    std::vector<float> triangles;
+    std::vector<unsigned char> straddles;
+    for (int i = 0; i < box.nx; ++i)
+    {
+        triangles.insert(triangles.end(), slab_triangles[i].begin(), slab_triangles[i].end());
+        straddles.insert(straddles.end(), slab_straddles[i].begin(), slab_straddles[i].end());
+    }
+
+    // a mirrored box only meshes the lower half: add the reflection across each symmetry plane
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        if (!(axis == 0 ? box.mirror_x : box.mirror_y))
+            continue;
+        double full_length = axis == 0 ? box.full_lx : box.full_ly;
+        size_t n = straddles.size();
+        for (size_t t = 0; t < n; ++t)
+        {
+            if (straddles[t] >> axis & 1)
+                continue;
+            size_t copy = triangles.size();
+            for (int v = 0; v < 10; ++v)
+                triangles.push_back(triangles[10 * t + v]);
+            for (int v = 0; v < 3; ++v)
+                triangles[copy + 3 * v + axis] = static_cast<float>(full_length - triangles[copy + 3 * v + axis]);
+            straddles.push_back(straddles[t]);
+        }
+    }
+    return triangles;
+}
+
+void save_electrode_surface(const std::vector<float> &triangles, const std::string &filename)
+{
+    std::ofstream outFile(filename, std::ios::binary);
+    if (!outFile)
+    {
+        std::cerr << "Error: Could not open file " << filename << " for writing.\n";
+        return;
+    }
+    outFile.write(reinterpret_cast<const char *>(triangles.data()), triangles.size() * sizeof(float));
+}
+
 /*
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1087,176 +571,72 @@ int main()
         std::string method = config.value("method", "jacobi");
         int max_iter = config.value("max_iter", 1000);
 
-        SimulationBox3D box(nx, ny, nz, lx*cm, ly*cm, lz*cm);
-
-        for (const auto &entry : fs::directory_iterator("."))
+        bool geometry_cache = config.value("geometry_cache", true);
+
+        // Preview: "surface" (default) writes the electrode surface as a triangle list for show_geometry.py,
+        // "full" the whole geometry grid as text. Grids above preview_max_cells (0 = no cap) are previewed
+        // on a proportionally coarser grid, which is not cached since the solver never uses it.
+        std::string preview = config.value("geometry_preview", "surface");
+        if (preview != "surface" && preview != "full")
+            throw std::runtime_error("Unknown geometry preview: " + preview);
+        long long preview_max_cells = config.value("preview_max_cells", 0LL);
+        long long cells = static_cast<long long>(nx) * ny * nz;
+        if (preview_max_cells > 0 && cells > preview_max_cells)
         {
-            fs::path filepath = entry.path();
-            std::string filename = filepath.filename().string();
+            double shrink = std::cbrt(static_cast<double>(preview_max_cells) / cells);
+            nx = std::max(2, static_cast<int>(std::lround(nx * shrink)));
+            ny = std::max(2, static_cast<int>(std::lround(ny * shrink)));
+            nz = std::max(2, static_cast<int>(std::lround(nz * shrink)));
+            geometry_cache = false;
+            std::cout << "Preview grid: " << nx << " x " << ny << " x " << nz << std::endl;
+        }
 
-            if (filepath.extension() == ".json" &&
-                filename.rfind("ElectrodeConfig_", 0) == 0)
+        // Same (possibly mirrored) grid as solve_simulation, so the solver can reuse the cached labels
+        bool mirror_x = false, mirror_y = false;
+        if (config.contains("symmetry_planes") && config["symmetry_planes"].is_array())
+        {
+            for (const auto &plane : config["symmetry_planes"])
             {
-                std::ifstream file(filepath);
-                if (!file.is_open())
-                {
-                    std::cerr << "Failed to open: " << filename << "\n";
-                    continue;
-                }
-
-                json j;
-                try
-                {
-                    file >> j;
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << "JSON parsing error in " << filename << ": " << e.what() << "\n";
-                    continue;
-                }
-
-                if (!j.contains("electrodes") || !j["electrodes"].is_array() || j["electrodes"].empty())
-                {
-                    std::cerr << "Invalid or missing 'electrodes' in " << filename << "\n";
-                    continue;
-                }
-
-                const auto &electrode = j["electrodes"][0];
-                std::string type = "Unknown";
-                if (electrode.contains("type") && electrode["type"].is_string())
-                {
-                    type = electrode["type"];
-                }
-
-                std::cout << "\nFile: " << filename << "\n";
-                std::cout << "Type: " << type << "\n";
-
-                if (type == "Plate")
-                {
-                    double A = electrode.value("A", 0.0);
-                    double B = electrode.value("B", 0.0);
-                    double C = electrode.value("C", 0.0);
-                    double D = electrode.value("D", 0.0);
-                    double thickness = electrode.value("thickness", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addPlane(A, B, C, D * cm, thickness * cm, potential_val);
-
-                    // cout<<A<<B<<C<<D*cm<<thickness*cm<<potential_val<<endl;
-                }
-
-                else if (type == "Cylinder")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double height = electrode.value("height", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addCylinder(cx*cm, cy*cm, cz*cm, radius*cm, height*cm, axis, potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
-
-                else if (type == "HollowRod")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double height = electrode.value("height", 0.0);
-                    double thickness = electrode.value("thickness", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addHollowPipe(cx*cm,cy*cm,cz*cm,radius*cm,thickness*cm,height*cm,axis,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
-
-                else if (type == "Box")
-                {
-                    double x0 = electrode.value("x0", 0.0);
-                    double y0 = electrode.value("y0", 0.0);
-                    double z0 = electrode.value("z0", 0.0);
-                    double x1 = electrode.value("x1", 0.0);
-                    double y1 = electrode.value("y1", 0.0);
-                    double z1 = electrode.value("z1", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addBox(x0*cm,y0*cm,z0*cm,x1*cm,y1*cm,z1*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+                if (plane == "x")
+                    mirror_x = true;
+                else if (plane == "y")
+                    mirror_y = true;
+            }
+        }
+        int box_nx = mirror_x ? (nx + 1) / 2 : nx;
+        int box_ny = mirror_y ? (ny + 1) / 2 : ny;
+        double box_lx = lx * (box_nx - 1) / (nx - 1);
+        double box_ly = ly * (box_ny - 1) / (ny - 1);
 
-                else if (type == "Spherical")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addSphere(cx*cm,cy*cm,cz*cm,radius*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        SimulationBox3D box(box_nx, box_ny, nz, box_lx*cm, box_ly*cm, lz*cm);
+        box.setSymmetry(mirror_x, mirror_y, nx, ny);
 
-                else if (type == "Ellipsoidal")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double rx = electrode.value("rx", 0.0);
-                    double ry = electrode.value("ry", 0.0);
-                    double rz = electrode.value("rz", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addEllipsoid(cx*cm,cy*cm,cz*cm,rx*cm,ry*cm,rz*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // Electrodes: every entry of every ElectrodeConfig_*.json, or of the "scene_file" if one is given
+        std::vector<std::pair<std::string, json>> electrodes = load_electrode_entries(config.value("scene_file", ""));
 
-                else if (type == "Hyperboloidal")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double a = electrode.value("a", 0.0);
-                    double b = electrode.value("b", 0.0);
-                    double c = electrode.value("c", 0.0);
-                    double waist = electrode.value("waist", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addHyperboloid(cx*cm,cy*cm,cz*cm,a*cm,b*cm,c*cm,waist*cm,axis,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
-
-                else
-                {
-                    std::cout << "  [!] Unknown electrode type. Skipping parsing.\n";
-                }
-            }
+        // Rasterize all electrodes in one fused pass, unless geometry_cache.bin already holds this scene
+        std::uint64_t geometry_key = geometry_hash(grid_key_json(nx, ny, nz, lx, ly, lz, mirror_x, mirror_y), electrodes);
+        if (!geometry_cache || !load_geometry_cache(box, electrodes, geometry_key, preview == "surface"))
+        {
+            box.rasterize(electrodes_from_json(electrodes));
+            if (geometry_cache)
+                save_geometry_cache(box, geometry_key);
         }
 
         // Save geometry
-        double_vector_save_txt(box.geometry, "geometry.txt");
+        if (preview == "surface")
+        {
+            std::vector<float> triangles = extract_electrode_surface(box);
+            save_electrode_surface(triangles, geometry_surface_file);
+            std::cout << "Electrode surface: " << triangles.size() / 10 << " triangles" << std::endl;
+        }
+        else
+        {
+            // the grid size show_geometry.py has to reshape geometry.txt to (smaller than config.json's when capped)
+            std::ofstream previewFile("geometry_preview.json");
+            previewFile << json{{"nx", nx}, {"ny", ny}, {"nz", nz}}.dump() << "\n";
+            double_vector_save_txt(box.unfoldedRowMajor(box.geometry), "geometry.txt");
+        }
 
         return 0;
     }
@@ -1,5 +1,6 @@
 import numpy as np
 import json
+import os
 from mayavi import mlab
 import glob
 import matplotlib.pyplot as plt
@@ -8,6 +9,7 @@ with open('config.json', 'r') as f:
     data = json.load(f)
 
 
+stride = max(int(data.get("efield_stride", 1)), 1)
 nx = data["nx"]
 ny = data["ny"]
 nz = data["nz"]
@@ -16,30 +18,71 @@ ly = data["Ly"]*1e-2
 lz = data["Lz"]*1e-2
 
 del data
-data = np.loadtxt("potential.txt")
 
-x, y, z = np.mgrid[0:lx:nx*1j,0:ly:ny*1j,0:lz:nz*1j]
+# field lines / equipotentials traced by solve_simulation ("trace" in config.json) are drawn instead of
+# the dense quiver when they are newer than the potential
+curves_file = "traced_curves.bin"
+use_curves = os.path.exists(curves_file) and (not os.path.exists("potential.txt") or
+                                              os.path.getmtime(curves_file) >= os.path.getmtime("potential.txt"))
+
+# solve_simulation writes the field the pusher uses to efield.npy (every efield_stride-th node);
+# fall back to differentiating potential.txt when it is missing or older than the potential
+field_file = "efield.npy"
+use_field = os.path.exists(field_file) and (not os.path.exists("potential.txt") or
+                                            os.path.getmtime(field_file) >= os.path.getmtime("potential.txt"))
+
 dx = np.diff(np.linspace(0,lx,nx))[0]
 dy = np.diff(np.linspace(0,ly,ny))[0]
 dz = np.diff(np.linspace(0,lz,nz))[0]
 
-potential = data[:]
-potential=potential.reshape(x.shape)
+mlab.figure(bgcolor=(1,1,1))
 
-Ex, Ey, Ez = np.gradient(-potential, dx, dy, dz, edge_order=2)
-stepx = 1
-stepy = 1
-stepz = 1
+if use_curves:
+    # header (magic, n_lines, kind, n_points), uint64 vertex offsets, float32 seed potentials, float32 xyz
+    header = np.fromfile(curves_file, dtype=[("magic", "S8"), ("n_lines", "<u4"), ("kind", "<u4"), ("n_points", "<u8")], count=1)[0]
+    n_lines, n_points = int(header["n_lines"]), int(header["n_points"])
+    offsets = np.fromfile(curves_file, dtype="<u8", count=n_lines+1, offset=24).astype(np.int64)
+    values = np.fromfile(curves_file, dtype="<f4", count=n_lines, offset=24+8*(n_lines+1))
+    xyz = np.fromfile(curves_file, dtype="<f4", count=3*n_points, offset=24+8*(n_lines+1)+4*n_lines).reshape(-1, 3)
 
-x,y,z = x[::stepx,::stepy,::stepz], y[::stepx,::stepy,::stepz], z[::stepx,::stepy,::stepz]
-Ex,Ey,Ez = Ex[::stepx,::stepy,::stepz], Ey[::stepx,::stepy,::stepz], Ez[::stepx,::stepy,::stepz]
+    if n_lines == 0:
+        print("No traced curves to show")
+    else:
+        # one polydata for all curves: consecutive vertices are joined except across curve starts
+        scalars = np.repeat(values, np.diff(offsets))
+        segment_start = np.arange(n_points - 1)
+        segment_start = segment_start[~np.isin(segment_start + 1, offsets[1:-1])]
+        source = mlab.pipeline.scalar_scatter(xyz[:, 0], xyz[:, 1], xyz[:, 2], scalars)
+        source.mlab_source.dataset.lines = np.column_stack([segment_start, segment_start + 1])
+        source.update()
+        mlab.pipeline.surface(source, colormap='jet', line_width=2)
+        mlab.colorbar(title="potential", orientation='vertical')
+    mlab.outline(extent=[0, lx, 0, ly, 0, lz], color=(0, 0, 0))
+    mlab.title('Equipotentials' if header["kind"] == 1 else 'Electric Field Lines')
+else:
+    if use_field:
+        E = np.load(field_file, mmap_mode="r")
+        sx, sy, sz = E.shape[:3]
+        x, y, z = np.meshgrid(np.arange(sx)*stride*dx, np.arange(sy)*stride*dy, np.arange(sz)*stride*dz, indexing="ij")
+        Ex, Ey, Ez = E[..., 0], E[..., 1], E[..., 2]
+    else:
+        data = np.loadtxt("potential.txt")
+
+        x, y, z = np.mgrid[0:lx:nx*1j,0:ly:ny*1j,0:lz:nz*1j]
+
+        potential = data[:]
+        potential=potential.reshape(x.shape)
+
+        Ex, Ey, Ez = np.gradient(-potential, dx, dy, dz, edge_order=2)
+        x,y,z = x[::stride,::stride,::stride], y[::stride,::stride,::stride], z[::stride,::stride,::stride]
+        Ex,Ey,Ez = Ex[::stride,::stride,::stride], Ey[::stride,::stride,::stride], Ez[::stride,::stride,::stride]
+
+    mlab.quiver3d(x, y, z, Ex, Ey, Ez,
+                mode='arrow',
+                colormap='jet')
+    mlab.title('3D Electric Field')
 
-mlab.figure(bgcolor=(1,1,1))
-mlab.quiver3d(x, y, z, Ex, Ey, Ez,
-            mode='arrow',
-            colormap='jet')
 axes = mlab.axes(xlabel='X', ylabel='Y', zlabel='Z',color=(1.0,0.0,0.0))
 axes.title_text_property.color = (1.0, 0.0, 0.0)  # red title text (if titles used)
 axes.label_text_property.color = (1.0, 0.0, 0.0)  # blue label text
-mlab.title('3D Electric Field')
-mlab.show()
\ No newline at end of file
+mlab.show()
@@ -1,5 +1,6 @@
 import numpy as np
 import json
+import os
 from mayavi import mlab
 import glob
 import matplotlib.pyplot as plt
@@ -16,21 +17,51 @@ ly = data["Ly"]*1e-2
 lz = data["Lz"]*1e-2
 
 del data
-data = np.loadtxt("geometry.txt")
 
-x, y, z = np.mgrid[0:lx:nx*1j,0:ly:ny*1j,0:lz:nz*1j]
+# save_geometry writes the electrode surface (geometry_surface.bin) unless "geometry_preview" is "full";
+# use whichever of the surface and geometry.txt is newer
+surface_file = "geometry_surface.bin"
+use_surface = os.path.exists(surface_file) and (not os.path.exists("geometry.txt") or
+                                                os.path.getmtime(surface_file) >= os.path.getmtime("geometry.txt"))
 
-potential = data[:]
-potential=potential.reshape(x.shape)
-
-contours=50
-opacity=0.08
-cmap="jet"
 mlab.figure(bgcolor=(1, 1, 1), size=(800, 600))
-mlab.contour3d(x, y, z, potential, contours=contours, opacity=opacity, colormap=cmap)
-mlab.colorbar(title="potential", orientation='vertical')
+cmap="jet"
+
+if use_surface:
+    # one record per triangle: x0 y0 z0 x1 y1 z1 x2 y2 z2 potential (float32)
+    triangles = np.fromfile(surface_file, dtype="<f4").reshape(-1, 10)
+    if len(triangles) == 0:
+        print("No electrode surface to show")
+    else:
+        vertices = triangles[:, :9].reshape(-1, 3)
+        faces = np.arange(len(vertices)).reshape(-1, 3)
+        scalars = np.repeat(triangles[:, 9], 3)
+        mlab.triangular_mesh(vertices[:, 0], vertices[:, 1], vertices[:, 2], faces, scalars=scalars, colormap=cmap)
+        mlab.colorbar(title="potential", orientation='vertical')
+    mlab.outline(extent=[0, lx, 0, ly, 0, lz], color=(0, 0, 0))
+    mlab.title("Electrode Surfaces")
+else:
+    data = np.loadtxt("geometry.txt")
+
+    # a capped preview grid is smaller than the one in config.json
+    if os.path.exists("geometry_preview.json"):
+        with open("geometry_preview.json", 'r') as f:
+            preview = json.load(f)
+        if data.size == preview["nx"] * preview["ny"] * preview["nz"]:
+            nx, ny, nz = preview["nx"], preview["ny"], preview["nz"]
+
+    x, y, z = np.mgrid[0:lx:nx*1j,0:ly:ny*1j,0:lz:nz*1j]
+
+    potential = data[:]
+    potential=potential.reshape(x.shape)
+
+    contours=50
+    opacity=0.08
+    mlab.contour3d(x, y, z, potential, contours=contours, opacity=opacity, colormap=cmap)
+    mlab.colorbar(title="potential", orientation='vertical')
+    mlab.title("3D Isosurface of Potential")
+
 axes = mlab.axes(xlabel='X', ylabel='Y', zlabel='Z',color=(1.0,0.0,0.0))
 axes.title_text_property.color = (1.0, 0.0, 0.0)
 axes.label_text_property.color = (1.0, 0.0, 0.0)
-mlab.title("3D Isosurface of Potential")
-mlab.show()
\ No newline at end of file
+mlab.show()
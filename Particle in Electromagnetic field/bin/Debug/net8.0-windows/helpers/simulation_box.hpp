@@ -0,0 +1,3616 @@
+/*
+Shared geometry code of solve_simulation.cpp and save_geometry.cpp: storage layouts of the grid arrays,
+the electrode primitives and their JSON parsing, the SimulationBox3D object (rasterizer, Laplace/Poisson
+solvers, field interpolation and batch probes) and the persistent geometry cache that lets the solver reuse
+the grid rasterized for the preview.
+
+Header-only, like json.hpp, so every helper executable still builds from its single .cpp file.
+*/
+
+#ifndef SIMULATION_BOX_HPP
+#define SIMULATION_BOX_HPP
+
+#include <iomanip>
+#include <fstream>
+#include <limits>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <deque>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include "json.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+inline double cm = 1e-2;
+inline double mm = 1e-3;
+inline double eps0 = 8.8541878128e-12;
+inline double pi = 3.14159265358979323846; // M_PI is not standard (MSVC needs _USE_MATH_DEFINES)
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                STORAGE LAYOUTS FOR THE GRID ARRAYS
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// plain row-major storage: +-i neighbours are ny*nz doubles apart
+struct RowMajorLayout
+{
+    int nx = 0, ny = 0, nz = 0;
+
+    RowMajorLayout() = default;
+    RowMajorLayout(int nx, int ny, int nz) : nx(nx), ny(ny), nz(nz) {}
+
+    size_t size() const { return static_cast<size_t>(nx) * ny * nz; }
+
+    int index(int i, int j, int k) const
+    {
+        return i * ny * nz + j * nz + k;
+    }
+};
+
+// 8x8x8 bricks (4 kB of doubles each) stored in Morton (Z) order of the brick coordinates,
+// cells row-major inside a brick. The grid is padded up to whole bricks.
+struct BrickLayout
+{
+    static constexpr int B = 8;
+    int nx = 0, ny = 0, nz = 0;
+    int nbx = 0, nby = 0, nbz = 0;
+    std::vector<int> brick_offset; // row-major brick number -> first cell of that brick
+
+    BrickLayout() = default;
+    BrickLayout(int nx, int ny, int nz);
+
+    size_t size() const { return brick_offset.size() * B * B * B; }
+
+    int index(int i, int j, int k) const
+    {
+        return brick_offset[((i >> 3) * nby + (j >> 3)) * nbz + (k >> 3)] + (((i & 7) << 6) | ((j & 7) << 3) | (k & 7));
+    }
+};
+
+// spread the lower 10 bits of v so that two zero bits sit between each of them
+static unsigned int morton_spread(unsigned int v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+inline BrickLayout::BrickLayout(int nx, int ny, int nz)
+    : nx(nx), ny(ny), nz(nz)
+{
+    nbx = (nx + B - 1) / B;
+    nby = (ny + B - 1) / B;
+    nbz = (nz + B - 1) / B;
+
+    int n_bricks = nbx * nby * nbz;
+    std::vector<std::pair<unsigned int, int>> order(n_bricks);
+    for (int bi = 0; bi < nbx; ++bi)
+        for (int bj = 0; bj < nby; ++bj)
+            for (int bk = 0; bk < nbz; ++bk)
+            {
+                int b = (bi * nby + bj) * nbz + bk;
+                order[b] = {(morton_spread(bi) << 2) | (morton_spread(bj) << 1) | morton_spread(bk), b};
+            }
+    std::sort(order.begin(), order.end());
+
+    brick_offset.resize(n_bricks);
+    for (int rank = 0; rank < n_bricks; ++rank)
+        brick_offset[order[rank].second] = rank * B * B * B;
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        PARALLEL HELPERS
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// Runs body(first, last) on contiguous chunks of [begin, end), one std::thread per hardware
+// thread. Chunks never overlap, so bodies that only write their own range need no locking.
+template <class Body>
+void parallel_for(int begin, int end, Body body)
+{
+    int n = end - begin;
+    if (n <= 0)
+        return;
+    int n_threads = std::min<int>(n, std::max(1u, std::thread::hardware_concurrency()));
+    if (n_threads == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads);
+    for (int t = 0; t < n_threads; ++t)
+    {
+        int first = begin + static_cast<int>(static_cast<long long>(n) * t / n_threads);
+        int last = begin + static_cast<int>(static_cast<long long>(n) * (t + 1) / n_threads);
+        workers.emplace_back(body, first, last);
+    }
+    for (auto &worker : workers)
+        worker.join();
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        ELECTRODE PRIMITIVES
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+static constexpr double unbounded = std::numeric_limits<double>::infinity();
+
+// Closed triangle surface (STL or OBJ) for "Mesh" electrodes, in metres. The triangles are
+// reordered into a bounding volume hierarchy that serves both the vertical-ray crossings used
+// for voxelizing (inside = odd number of crossings above a point) and nearest-surface queries.
+struct TriangleMesh
+{
+    using Vec3 = std::array<double, 3>;
+    struct Triangle
+    {
+        Vec3 v0, v1, v2;
+    };
+    struct Node
+    {
+        Vec3 lo, hi;
+        int first, count; // leaf: triangles [first, first + count); inner: count = 0
+        int right;        // inner: right child (left child is the next node)
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<Node> nodes;
+
+    static std::shared_ptr<TriangleMesh> load(const std::string &path, double scale);
+    void build();
+
+    const Vec3 &lo() const { return nodes[0].lo; }
+    const Vec3 &hi() const { return nodes[0].hi; }
+
+    // sorted z of every crossing of the vertical line through (x, y) with the surface
+    void columnCrossings(double x, double y, std::vector<double> &zs) const;
+    bool inside(double x, double y, double z) const;
+    double distance(double x, double y, double z) const;
+
+private:
+    int buildNode(int first, int count);
+    void readStl(const std::string &path, double scale);
+    void readObj(const std::string &path, double scale);
+};
+
+inline std::shared_ptr<TriangleMesh> TriangleMesh::load(const std::string &path, double scale)
+{
+    auto mesh = std::make_shared<TriangleMesh>();
+    std::string extension = fs::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char ch) { return std::tolower(ch); });
+    if (extension == ".obj")
+        mesh->readObj(path, scale);
+    else
+        mesh->readStl(path, scale);
+
+    if (mesh->triangles.empty())
+        throw std::runtime_error("No triangles in " + path);
+    mesh->build();
+    return mesh;
+}
+
+// Binary STL: 80 byte header, uint32 count, 50 bytes per triangle. Anything else is read as ASCII.
+inline void TriangleMesh::readStl(const std::string &path, double scale)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not open mesh file " + path);
+
+    file.seekg(0, std::ios::end);
+    std::uint64_t file_size = static_cast<std::uint64_t>(file.tellg());
+    file.seekg(0);
+
+    char header[80] = {};
+    std::uint32_t count = 0;
+    file.read(header, 80);
+    file.read(reinterpret_cast<char *>(&count), 4);
+    if (file && file_size == 84 + 50ull * count)
+    {
+        triangles.resize(count);
+        std::vector<char> record(50 * static_cast<size_t>(count));
+        file.read(record.data(), record.size());
+        for (std::uint32_t t = 0; t < count; ++t)
+        {
+            float values[9];
+            std::memcpy(values, record.data() + 50 * static_cast<size_t>(t) + 12, sizeof(values)); // skip the normal
+            Vec3 *corner[3] = {&triangles[t].v0, &triangles[t].v1, &triangles[t].v2};
+            for (int v = 0; v < 3; ++v)
+                for (int d = 0; d < 3; ++d)
+                    (*corner[v])[d] = values[3 * v + d] * scale;
+        }
+        return;
+    }
+
+    file.clear();
+    file.seekg(0);
+    std::string word;
+    Triangle triangle;
+    int n_vertices = 0;
+    while (file >> word)
+    {
+        if (word != "vertex")
+            continue;
+        Vec3 &v = (n_vertices == 0) ? triangle.v0 : (n_vertices == 1) ? triangle.v1 : triangle.v2;
+        file >> v[0] >> v[1] >> v[2];
+        for (double &value : v)
+            value *= scale;
+        if (++n_vertices == 3)
+        {
+            triangles.push_back(triangle);
+            n_vertices = 0;
+        }
+    }
+}
+
+// Wavefront OBJ: "v x y z" and "f a b c ..." (polygons are fanned, negative indices count from the end)
+inline void TriangleMesh::readObj(const std::string &path, double scale)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Could not open mesh file " + path);
+
+    std::vector<Vec3> vertices;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string tag;
+        stream >> tag;
+        if (tag == "v")
+        {
+            Vec3 v;
+            stream >> v[0] >> v[1] >> v[2];
+            vertices.push_back({v[0] * scale, v[1] * scale, v[2] * scale});
+        }
+        else if (tag == "f")
+        {
+            std::vector<int> face;
+            std::string corner;
+            while (stream >> corner)
+            {
+                int n = std::stoi(corner.substr(0, corner.find('/')));
+                face.push_back(n < 0 ? static_cast<int>(vertices.size()) + n : n - 1);
+            }
+            for (size_t v = 2; v < face.size(); ++v)
+            {
+                if (face[0] < 0 || face[v - 1] < 0 || face[v] < 0 ||
+                    face[0] >= static_cast<int>(vertices.size()) || face[v - 1] >= static_cast<int>(vertices.size()) ||
+                    face[v] >= static_cast<int>(vertices.size()))
+                    throw std::runtime_error("Bad face index in " + path);
+                triangles.push_back({vertices[face[0]], vertices[face[v - 1]], vertices[face[v]]});
+            }
+        }
+    }
+}
+
+inline void TriangleMesh::build()
+{
+    nodes.clear();
+    nodes.reserve(2 * triangles.size() / 4 + 1);
+    buildNode(0, static_cast<int>(triangles.size()));
+}
+
+// median split along the longest axis of the centroid bounds, at most 4 triangles per leaf
+inline int TriangleMesh::buildNode(int first, int count)
+{
+    int id = static_cast<int>(nodes.size());
+    nodes.push_back({});
+
+    Vec3 lo = {unbounded, unbounded, unbounded}, hi = {-unbounded, -unbounded, -unbounded};
+    Vec3 c_lo = lo, c_hi = hi;
+    for (int t = first; t < first + count; ++t)
+    {
+        const Triangle &tri = triangles[t];
+        for (int d = 0; d < 3; ++d)
+        {
+            lo[d] = std::min({lo[d], tri.v0[d], tri.v1[d], tri.v2[d]});
+            hi[d] = std::max({hi[d], tri.v0[d], tri.v1[d], tri.v2[d]});
+            double centroid = tri.v0[d] + tri.v1[d] + tri.v2[d];
+            c_lo[d] = std::min(c_lo[d], centroid);
+            c_hi[d] = std::max(c_hi[d], centroid);
+        }
+    }
+
+    if (count <= 4)
+    {
+        nodes[id] = {lo, hi, first, count, -1};
+        return id;
+    }
+
+    int axis = 0;
+    for (int d = 1; d < 3; ++d)
+        if (c_hi[d] - c_lo[d] > c_hi[axis] - c_lo[axis])
+            axis = d;
+    int half = count / 2;
+    std::nth_element(triangles.begin() + first, triangles.begin() + first + half, triangles.begin() + first + count,
+                     [axis](const Triangle &a, const Triangle &b)
+                     { return a.v0[axis] + a.v1[axis] + a.v2[axis] < b.v0[axis] + b.v1[axis] + b.v2[axis]; });
+
+    buildNode(first, half);
+    int right = buildNode(first + half, count - half);
+    nodes[id] = {lo, hi, first, 0, right};
+    return id;
+}
+
+// Point-in-projected-triangle with a top-left fill rule, so a column through a shared edge or
+// vertex is counted by exactly one of the triangles on either side of it
+static bool covers_xy(const TriangleMesh::Triangle &t, double x, double y, double &z)
+{
+    const TriangleMesh::Vec3 *a = &t.v0, *b = &t.v1, *c = &t.v2;
+    double area = ((*b)[0] - (*a)[0]) * ((*c)[1] - (*a)[1]) - ((*b)[1] - (*a)[1]) * ((*c)[0] - (*a)[0]);
+    if (area == 0.0)
+        return false; // vertical triangles are never crossed by a vertical ray
+    if (area < 0.0)
+    {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    auto edge = [x, y](const TriangleMesh::Vec3 &p, const TriangleMesh::Vec3 &q, double &w)
+    {
+        w = (q[0] - p[0]) * (y - p[1]) - (q[1] - p[1]) * (x - p[0]);
+        if (w != 0.0)
+            return w > 0.0;
+        double ex = q[0] - p[0], ey = q[1] - p[1];
+        return ey < 0.0 || (ey == 0.0 && ex > 0.0); // top or left edge of a counter-clockwise triangle
+    };
+    double w0, w1, w2;
+    if (!edge(*b, *c, w0) || !edge(*c, *a, w1) || !edge(*a, *b, w2))
+        return false;
+
+    z = (w0 * (*a)[2] + w1 * (*b)[2] + w2 * (*c)[2]) / area;
+    return true;
+}
+
+inline void TriangleMesh::columnCrossings(double x, double y, std::vector<double> &zs) const
+{
+    zs.clear();
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node &node = nodes[stack[--top]];
+        if (x < node.lo[0] || x > node.hi[0] || y < node.lo[1] || y > node.hi[1])
+            continue;
+        if (node.count > 0)
+        {
+            double z;
+            for (int t = node.first; t < node.first + node.count; ++t)
+                if (covers_xy(triangles[t], x, y, z))
+                    zs.push_back(z);
+            continue;
+        }
+        int id = static_cast<int>(&node - nodes.data());
+        stack[top++] = node.right;
+        stack[top++] = id + 1;
+    }
+    std::sort(zs.begin(), zs.end());
+}
+
+inline bool TriangleMesh::inside(double x, double y, double z) const
+{
+    thread_local std::vector<double> zs;
+    columnCrossings(x, y, zs);
+    size_t above = zs.end() - std::upper_bound(zs.begin(), zs.end(), z);
+    return above % 2 == 1;
+}
+
+// squared distance from p to the closest point of triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+static double triangle_distance2(const TriangleMesh::Triangle &t, const TriangleMesh::Vec3 &p)
+{
+    using Vec3 = TriangleMesh::Vec3;
+    auto sub = [](const Vec3 &u, const Vec3 &v) { return Vec3{u[0] - v[0], u[1] - v[1], u[2] - v[2]}; };
+    auto dot = [](const Vec3 &u, const Vec3 &v) { return u[0] * v[0] + u[1] * v[1] + u[2] * v[2]; };
+    auto dist2 = [&](const Vec3 &q) { Vec3 d = sub(p, q); return dot(d, d); };
+    auto along = [](const Vec3 &o, const Vec3 &e, double s) { return Vec3{o[0] + s * e[0], o[1] + s * e[1], o[2] + s * e[2]}; };
+
+    const Vec3 &a = t.v0, &b = t.v1, &c = t.v2;
+    Vec3 ab = sub(b, a), ac = sub(c, a), ap = sub(p, a);
+    double d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0.0 && d2 <= 0.0)
+        return dist2(a);
+
+    Vec3 bp = sub(p, b);
+    double d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0.0 && d4 <= d3)
+        return dist2(b);
+
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+        return dist2(along(a, ab, d1 / (d1 - d3)));
+
+    Vec3 cp = sub(p, c);
+    double d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0.0 && d5 <= d6)
+        return dist2(c);
+
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+        return dist2(along(a, ac, d2 / (d2 - d6)));
+
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0)
+        return dist2(along(b, sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+
+    double denom = 1.0 / (va + vb + vc);
+    Vec3 q = along(along(a, ab, vb * denom), ac, vc * denom);
+    return dist2(q);
+}
+
+inline double TriangleMesh::distance(double x, double y, double z) const
+{
+    Vec3 p = {x, y, z};
+    auto box_distance2 = [&p](const Node &node)
+    {
+        double sum = 0.0;
+        for (int d = 0; d < 3; ++d)
+        {
+            double gap = std::max({node.lo[d] - p[d], 0.0, p[d] - node.hi[d]});
+            sum += gap * gap;
+        }
+        return sum;
+    };
+
+    double best = unbounded;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const Node &node = nodes[stack[--top]];
+        if (box_distance2(node) >= best)
+            continue;
+        if (node.count > 0)
+        {
+            for (int t = node.first; t < node.first + node.count; ++t)
+                best = std::min(best, triangle_distance2(triangles[t], p));
+            continue;
+        }
+        // visit the nearer child first
+        int left = static_cast<int>(&node - nodes.data()) + 1;
+        bool left_first = box_distance2(nodes[left]) <= box_distance2(nodes[node.right]);
+        stack[top++] = left_first ? node.right : left;
+        stack[top++] = left_first ? left : node.right;
+    }
+    return std::sqrt(best);
+}
+
+struct CsgProgram;
+
+// One rasterizable electrode shape in SI units. The factories precompute everything the
+// inside test needs (squared radii, reciprocals) plus the physical bounding box, which is
+// infinite along the directions in which the shape is unbounded.
+struct Electrode
+{
+    enum Kind
+    {
+        None,
+        Sphere,
+        Box,
+        Cylinder,
+        HollowPipe,
+        Ellipsoid,
+        Hyperboloid,
+        Plane,
+        Mesh,
+        Csg
+    };
+
+    Kind kind = None;
+    char axis = 'z';
+    std::array<double, 7> p{};
+    std::array<double, 3> lo{}, hi{};
+    double potential = 0.0;
+    int label = 0;
+    std::shared_ptr<const TriangleMesh> mesh; // Mesh only, shared between copies
+    std::shared_ptr<const CsgProgram> csg;    // Csg only
+
+    static Electrode sphere(double cx, double cy, double cz, double radius, double potential_value);
+    static Electrode box(double x0, double y0, double z0, double x1, double y1, double z1, double potential_value);
+    static Electrode cylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value);
+    static Electrode hollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value);
+    static Electrode ellipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value);
+    static Electrode hyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value);
+    static Electrode plane(double A, double B, double C, double D, double thickness, double potential_value);
+    static Electrode fromMesh(std::shared_ptr<const TriangleMesh> mesh, double potential_value);
+    static Electrode fromCsg(std::shared_ptr<const CsgProgram> csg, double potential_value);
+
+    bool bounded() const
+    {
+        for (int d = 0; d < 3; ++d)
+            if (!std::isfinite(lo[d]) || !std::isfinite(hi[d]))
+                return false;
+        return true;
+    }
+
+    // Optional rigid placement: world = rotation * local + shift. The shape keeps its own frame and
+    // points are mapped into it by to_local (3x4, row-major); lo/hi become the world bounds.
+    // Meshes are moved vertex by vertex instead, so their BVH stays in world coordinates.
+    bool transformed = false;
+    std::array<double, 12> to_local{};
+    void place(const std::array<double, 9> &rotation, const std::array<double, 3> &shift);
+
+    // z extent of the column through (x, y); false if the column misses the shape entirely
+    bool zRange(double x, double y, double &z_lo, double &z_hi) const;
+
+    bool contains(double x, double y, double z) const
+    {
+        if (!transformed)
+            return containsLocal(x, y, z);
+        const auto &m = to_local;
+        return containsLocal(m[0] * x + m[1] * y + m[2] * z + m[3],
+                             m[4] * x + m[5] * y + m[6] * z + m[7],
+                             m[8] * x + m[9] * y + m[10] * z + m[11]);
+    }
+    bool containsLocal(double x, double y, double z) const;
+
+    // distance to the surface, negative inside. Exact for spheres, boxes, cylinders, pipes and
+    // plates; a first-order estimate (f / |grad f|) for ellipsoids and hyperboloids.
+    double signedDistance(double x, double y, double z) const
+    {
+        if (!transformed)
+            return signedDistanceLocal(x, y, z);
+        const auto &m = to_local;
+        return signedDistanceLocal(m[0] * x + m[1] * y + m[2] * z + m[3],
+                                   m[4] * x + m[5] * y + m[6] * z + m[7],
+                                   m[8] * x + m[9] * y + m[10] * z + m[11]);
+    }
+    double signedDistanceLocal(double x, double y, double z) const;
+};
+
+// A CSG tree flattened in pre-order: every node records where its subtree ends (skip), so
+// children are walked by jumping from skip to skip and a whole subtree is culled in one step
+// when the point lies outside its bounding box.
+struct CsgProgram
+{
+    struct Instruction
+    {
+        enum Op
+        {
+            Leaf,
+            Union,
+            Intersection,
+            Difference // first child minus all the others
+        };
+        Op op;
+        int skip;  // index one past the end of this subtree
+        int leaf;  // Leaf only: index into leaves
+        std::array<double, 3> lo, hi;
+    };
+
+    std::vector<Instruction> code;
+    std::vector<Electrode> leaves;
+
+    bool contains(double x, double y, double z, int pc = 0) const;
+    double signedDistance(double x, double y, double z, int pc = 0) const;
+};
+
+// Axis-aligned bounds of a cylinder of radius r whose axis runs from (cx, cy, cz) over height
+static void axial_bounds(Electrode &e, double cx, double cy, double cz, double r, double height)
+{
+    std::array<double, 3> center = {cx, cy, cz};
+    int a = e.axis - 'x';
+    for (int d = 0; d < 3; ++d)
+    {
+        e.lo[d] = (d == a) ? std::min(center[d], center[d] + height) : center[d] - r;
+        e.hi[d] = (d == a) ? std::max(center[d], center[d] + height) : center[d] + r;
+    }
+}
+
+inline Electrode Electrode::sphere(double cx, double cy, double cz, double radius, double potential_value)
+{
+    Electrode e;
+    e.kind = Sphere;
+    e.p = {cx, cy, cz, radius * radius};
+    e.lo = {cx - radius, cy - radius, cz - radius};
+    e.hi = {cx + radius, cy + radius, cz + radius};
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::box(double x0, double y0, double z0, double x1, double y1, double z1, double potential_value)
+{
+    Electrode e;
+    e.kind = Box;
+    e.p = {x0, y0, z0, x1, y1, z1};
+    e.lo = {x0, y0, z0};
+    e.hi = {x1, y1, z1};
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::cylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value)
+{
+    Electrode e;
+    if (axis != 'x' && axis != 'y' && axis != 'z')
+        return e;
+    e.kind = Cylinder;
+    e.axis = axis;
+    e.p = {cx, cy, cz, radius * radius, height};
+    axial_bounds(e, cx, cy, cz, radius, height);
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::hollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value)
+{
+    Electrode e;
+    if (axis != 'x' && axis != 'y' && axis != 'z')
+        return e;
+    e.kind = HollowPipe;
+    e.axis = axis;
+    double r_outer = radius + thickness / 2.0;
+    double r_inner = radius - thickness / 2.0;
+    e.p = {cx, cy, cz, r_inner * r_inner, r_outer * r_outer, height};
+    axial_bounds(e, cx, cy, cz, r_outer, height);
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::ellipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value)
+{
+    Electrode e;
+    e.kind = Ellipsoid;
+    e.p = {cx, cy, cz, 1.0 / (rx * rx), 1.0 / (ry * ry), 1.0 / (rz * rz)};
+    e.lo = {cx - std::abs(rx), cy - std::abs(ry), cz - std::abs(rz)};
+    e.hi = {cx + std::abs(rx), cy + std::abs(ry), cz + std::abs(rz)};
+    e.potential = potential_value;
+    return e;
+}
+
+// A one-sheet hyperboloid region is unbounded; an unknown axis keeps every cell (0 <= waist^2)
+inline Electrode Electrode::hyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value)
+{
+    Electrode e;
+    e.kind = Hyperboloid;
+    e.axis = axis;
+    double sx = 1.0 / (a * a), sy = 1.0 / (b * b), sz = 1.0 / (c * c);
+    if (axis == 'x')
+        sx = -sx;
+    else if (axis == 'y')
+        sy = -sy;
+    else if (axis == 'z')
+        sz = -sz;
+    else
+        sx = sy = sz = 0.0;
+    e.p = {cx, cy, cz, sx, sy, sz, waist * waist};
+    e.lo = {-unbounded, -unbounded, -unbounded};
+    e.hi = {unbounded, unbounded, unbounded};
+    e.potential = potential_value;
+    return e;
+}
+
+// Slab |A x + B y + C z + D| <= |(A, B, C)| * thickness / 2
+inline Electrode Electrode::plane(double A, double B, double C, double D, double thickness, double potential_value)
+{
+    Electrode e;
+    double norm = std::sqrt(A * A + B * B + C * C);
+    if (norm == 0.0)
+        return e;
+    e.kind = Plane;
+    e.p = {A, B, C, D, norm * thickness / 2.0, norm};
+    e.lo = {-unbounded, -unbounded, -unbounded};
+    e.hi = {unbounded, unbounded, unbounded};
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::fromMesh(std::shared_ptr<const TriangleMesh> mesh, double potential_value)
+{
+    Electrode e;
+    e.kind = Mesh;
+    e.lo = mesh->lo();
+    e.hi = mesh->hi();
+    e.mesh = std::move(mesh);
+    e.potential = potential_value;
+    return e;
+}
+
+inline Electrode Electrode::fromCsg(std::shared_ptr<const CsgProgram> csg, double potential_value)
+{
+    Electrode e;
+    e.kind = Csg;
+    e.lo = csg->code[0].lo;
+    e.hi = csg->code[0].hi;
+    e.csg = std::move(csg);
+    e.potential = potential_value;
+    return e;
+}
+
+inline void Electrode::place(const std::array<double, 9> &R, const std::array<double, 3> &shift)
+{
+    if (kind == None)
+        return;
+
+    auto to_world = [&R, &shift](const TriangleMesh::Vec3 &v)
+    {
+        TriangleMesh::Vec3 w;
+        for (int d = 0; d < 3; ++d)
+            w[d] = R[3 * d] * v[0] + R[3 * d + 1] * v[1] + R[3 * d + 2] * v[2] + shift[d];
+        return w;
+    };
+
+    if (kind == Mesh)
+    {
+        auto moved = std::make_shared<TriangleMesh>(*mesh);
+        for (auto &t : moved->triangles)
+        {
+            t.v0 = to_world(t.v0);
+            t.v1 = to_world(t.v1);
+            t.v2 = to_world(t.v2);
+        }
+        moved->build();
+        lo = moved->lo();
+        hi = moved->hi();
+        mesh = moved;
+        return;
+    }
+
+    // inverse placement R^T (x - shift), composed with any placement applied before
+    std::array<double, 12> inverse;
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 3; ++c)
+            inverse[4 * r + c] = R[3 * c + r];
+        inverse[4 * r + 3] = -(R[r] * shift[0] + R[3 + r] * shift[1] + R[6 + r] * shift[2]);
+    }
+    if (transformed)
+    {
+        std::array<double, 12> composed;
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                composed[4 * r + c] = to_local[4 * r] * inverse[c] + to_local[4 * r + 1] * inverse[4 + c] +
+                                      to_local[4 * r + 2] * inverse[8 + c] + (c == 3 ? to_local[4 * r + 3] : 0.0);
+        to_local = composed;
+    }
+    else
+    {
+        to_local = inverse;
+    }
+    transformed = true;
+
+    // world bounds of the eight corners of the previous bounds
+    if (!bounded())
+    {
+        lo = {-unbounded, -unbounded, -unbounded};
+        hi = {unbounded, unbounded, unbounded};
+        return;
+    }
+    std::array<double, 3> new_lo = {unbounded, unbounded, unbounded}, new_hi = {-unbounded, -unbounded, -unbounded};
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        TriangleMesh::Vec3 v = {(corner & 1) ? hi[0] : lo[0], (corner & 2) ? hi[1] : lo[1], (corner & 4) ? hi[2] : lo[2]};
+        TriangleMesh::Vec3 w = to_world(v);
+        for (int d = 0; d < 3; ++d)
+        {
+            new_lo[d] = std::min(new_lo[d], w[d]);
+            new_hi[d] = std::max(new_hi[d], w[d]);
+        }
+    }
+    lo = new_lo;
+    hi = new_hi;
+}
+
+inline bool Electrode::zRange(double x, double y, double &z_lo, double &z_hi) const
+{
+    z_lo = lo[2];
+    z_hi = hi[2];
+    if (transformed)
+        return kind != None; // the column shortcuts below work in the local frame
+    switch (kind)
+    {
+    case Sphere:
+    {
+        double rest = p[3] - (x - p[0]) * (x - p[0]) - (y - p[1]) * (y - p[1]);
+        if (rest < 0.0)
+            return false;
+        double half = std::sqrt(rest);
+        z_lo = p[2] - half;
+        z_hi = p[2] + half;
+        return true;
+    }
+    case Ellipsoid:
+    {
+        double rest = 1.0 - (x - p[0]) * (x - p[0]) * p[3] - (y - p[1]) * (y - p[1]) * p[4];
+        if (rest < 0.0)
+            return false;
+        double half = std::sqrt(rest / p[5]);
+        z_lo = p[2] - half;
+        z_hi = p[2] + half;
+        return true;
+    }
+    case Plane:
+    {
+        double partial = p[0] * x + p[1] * y + p[3];
+        if (p[2] == 0.0)
+            return std::abs(partial) <= p[4];
+        double z_a = (-p[4] - partial) / p[2];
+        double z_b = (p[4] - partial) / p[2];
+        z_lo = std::min(z_a, z_b);
+        z_hi = std::max(z_a, z_b);
+        return true;
+    }
+    case None:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// signed distance of a 2D box-like region from its two per-axis distances
+static double combine_distances(double a, double b)
+{
+    double outside = std::hypot(std::max(a, 0.0), std::max(b, 0.0));
+    return outside + std::min(std::max(a, b), 0.0);
+}
+
+inline double Electrode::signedDistanceLocal(double x, double y, double z) const
+{
+    switch (kind)
+    {
+    case Sphere:
+        return std::sqrt((x - p[0]) * (x - p[0]) + (y - p[1]) * (y - p[1]) + (z - p[2]) * (z - p[2])) - std::sqrt(p[3]);
+
+    case Box:
+    {
+        double qx = std::max(p[0] - x, x - p[3]);
+        double qy = std::max(p[1] - y, y - p[4]);
+        double qz = std::max(p[2] - z, z - p[5]);
+        double outside = std::sqrt(std::pow(std::max(qx, 0.0), 2) + std::pow(std::max(qy, 0.0), 2) + std::pow(std::max(qz, 0.0), 2));
+        return outside + std::min(std::max({qx, qy, qz}), 0.0);
+    }
+
+    case Cylinder:
+    case HollowPipe:
+    {
+        double r, u, base;
+        if (axis == 'z')
+        {
+            r = std::hypot(x - p[0], y - p[1]);
+            u = z;
+            base = p[2];
+        }
+        else if (axis == 'x')
+        {
+            r = std::hypot(y - p[1], z - p[2]);
+            u = x;
+            base = p[0];
+        }
+        else
+        {
+            r = std::hypot(x - p[0], z - p[2]);
+            u = y;
+            base = p[1];
+        }
+        double height = (kind == Cylinder) ? p[4] : p[5];
+        double axial = std::abs(u - (base + height / 2.0)) - std::abs(height) / 2.0;
+        double radial;
+        if (kind == Cylinder)
+        {
+            radial = r - std::sqrt(p[3]);
+        }
+        else
+        {
+            double r_inner = std::sqrt(p[3]), r_outer = std::sqrt(p[4]);
+            radial = std::abs(r - (r_inner + r_outer) / 2.0) - (r_outer - r_inner) / 2.0;
+        }
+        return combine_distances(radial, axial);
+    }
+
+    case Ellipsoid:
+    {
+        // |q/r| (|q/r| - 1) / |q/r^2|, q = offset from the centre
+        double qx = x - p[0], qy = y - p[1], qz = z - p[2];
+        double k0 = std::sqrt(qx * qx * p[3] + qy * qy * p[4] + qz * qz * p[5]);
+        double k1 = std::sqrt(qx * qx * p[3] * p[3] + qy * qy * p[4] * p[4] + qz * qz * p[5] * p[5]);
+        if (k1 == 0.0)
+            return -1.0 / std::sqrt(std::max({p[3], p[4], p[5]}));
+        return k0 * (k0 - 1.0) / k1;
+    }
+
+    case Hyperboloid:
+    {
+        double qx = x - p[0], qy = y - p[1], qz = z - p[2];
+        double f = p[3] * qx * qx + p[4] * qy * qy + p[5] * qz * qz - p[6];
+        double gradient = 2.0 * std::sqrt(p[3] * p[3] * qx * qx + p[4] * p[4] * qy * qy + p[5] * p[5] * qz * qz);
+        return gradient > 0.0 ? f / gradient : f;
+    }
+
+    case Plane:
+        return (std::abs(p[0] * x + p[1] * y + p[3] + p[2] * z) - p[4]) / p[5];
+
+    case Mesh:
+    {
+        double distance = mesh->distance(x, y, z);
+        return mesh->inside(x, y, z) ? -distance : distance;
+    }
+
+    case Csg:
+        return csg->signedDistance(x, y, z);
+
+    default:
+        return unbounded;
+    }
+}
+
+inline bool CsgProgram::contains(double x, double y, double z, int pc) const
+{
+    const Instruction &node = code[pc];
+    if (x < node.lo[0] || x > node.hi[0] || y < node.lo[1] || y > node.hi[1] || z < node.lo[2] || z > node.hi[2])
+        return false;
+    if (node.op == Instruction::Leaf)
+        return leaves[node.leaf].contains(x, y, z);
+
+    for (int child = pc + 1; child < node.skip; child = code[child].skip)
+    {
+        bool inside = contains(x, y, z, child);
+        if (node.op == Instruction::Union && inside)
+            return true;
+        if (node.op == Instruction::Intersection && !inside)
+            return false;
+        if (node.op == Instruction::Difference && inside != (child == pc + 1))
+            return false;
+    }
+    return node.op != Instruction::Union;
+}
+
+// min / max / max(a, -b) of the children: a bound rather than the exact distance, which is all
+// the cut-cell interpolation needs close to the surface
+inline double CsgProgram::signedDistance(double x, double y, double z, int pc) const
+{
+    const Instruction &node = code[pc];
+    if (node.op == Instruction::Leaf)
+        return leaves[node.leaf].signedDistance(x, y, z);
+
+    double result = (node.op == Instruction::Union) ? unbounded : -unbounded;
+    for (int child = pc + 1; child < node.skip; child = code[child].skip)
+    {
+        double distance = signedDistance(x, y, z, child);
+        if (node.op == Instruction::Union)
+            result = std::min(result, distance);
+        else if (node.op == Instruction::Intersection || child == pc + 1)
+            result = std::max(result, distance);
+        else
+            result = std::max(result, -distance);
+    }
+    return result;
+}
+
+inline bool Electrode::containsLocal(double x, double y, double z) const
+{
+    switch (kind)
+    {
+    case Sphere:
+        return (x - p[0]) * (x - p[0]) + (y - p[1]) * (y - p[1]) + (z - p[2]) * (z - p[2]) <= p[3];
+
+    case Box:
+        return x >= p[0] && x <= p[3] && y >= p[1] && y <= p[4] && z >= p[2] && z <= p[5];
+
+    case Cylinder:
+    case HollowPipe:
+    {
+        double r2, u, base;
+        if (axis == 'z')
+        {
+            r2 = (x - p[0]) * (x - p[0]) + (y - p[1]) * (y - p[1]);
+            u = z;
+            base = p[2];
+        }
+        else if (axis == 'x')
+        {
+            r2 = (y - p[1]) * (y - p[1]) + (z - p[2]) * (z - p[2]);
+            u = x;
+            base = p[0];
+        }
+        else
+        {
+            r2 = (x - p[0]) * (x - p[0]) + (z - p[2]) * (z - p[2]);
+            u = y;
+            base = p[1];
+        }
+        if (kind == Cylinder)
+            return r2 <= p[3] && u >= base && u <= base + p[4];
+        return r2 >= p[3] && r2 <= p[4] && u >= base && u <= base + p[5];
+    }
+
+    case Ellipsoid:
+        return (x - p[0]) * (x - p[0]) * p[3] + (y - p[1]) * (y - p[1]) * p[4] + (z - p[2]) * (z - p[2]) * p[5] <= 1.0;
+
+    case Hyperboloid:
+        return p[3] * (x - p[0]) * (x - p[0]) + p[4] * (y - p[1]) * (y - p[1]) + p[5] * (z - p[2]) * (z - p[2]) <= p[6];
+
+    case Plane:
+        return std::abs(p[0] * x + p[1] * y + p[3] + p[2] * z) <= p[4];
+
+    case Mesh:
+        return mesh->inside(x, y, z);
+
+    case Csg:
+        return csg->contains(x, y, z);
+
+    default:
+        return false;
+    }
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                3D SIMULATION BOX OBJECT FOR MAIN GEOMETRY
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// How the field grids are read between nodes ("interpolation" in config.json)
+enum class FieldInterpolation
+{
+    Nearest,  // field of the cell the particle is in
+    Trilinear, // weighted from the 8 surrounding nodes
+    Bspline    // gradient of the cubic B-spline of the potential (C1 across cells)
+};
+
+class SimulationBox3D
+{
+public:
+    int nx, ny, nz;
+    double lx, ly, lz;
+    double dx, dy, dz;
+
+    SimulationBox3D(int nx, int ny, int nz,
+                    double lx, double ly, double lz,
+                    double potential_offset = 0.0);
+
+    void addSphere(double cx, double cy, double cz, double radius, double potential_value);
+    void addBox(double x0, double y0, double z0,
+                double x1, double y1, double z1, double potential_value);
+
+    void addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value);
+    void addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value);
+    void addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value);
+    void addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value);
+    void addPlane(double A, double B, double C, double D, double thickness, double potential_value);
+
+    // every add* call tags its cells with current_label (0 = no electrode); rasterize takes the
+    // labels from the electrodes themselves
+    void addElectrode(Electrode electrode);
+    void rasterize(const std::vector<Electrode> &electrodes);
+    void markElectrode(int idx, double potential_value, int electrode_label)
+    {
+        potential[idx] = potential_value;
+        geometry[idx] = potential_value;
+        fixed_mask[idx] = true;
+        label[idx] = electrode_label;
+    }
+
+    void solve(int max_iter = 1000, double tol = 1e-4, const std::string &method = "jacobi");
+
+    // residual-driven relaxation seeded with the free cells of the given index region; returns true once
+    // every residual is below tol, false if it stopped at max_updates (updates receives the count either way)
+    bool relaxLocal(int i0, int i1, int j0, int j1, int k0, int k1, double tol, long long max_updates, long long &updates);
+    double neighbourAverage(int i, int j, int k) const;
+
+    // restrict the add* methods to an inclusive index region (used to patch part of the grid)
+    void setWindow(int i0, int i1, int j0, int j1, int k0, int k1);
+    void resetWindow();
+
+    // Batched Laplace solve: all solutions share fixed_mask and the cut cells, fixed_values[s] holds
+    // the electrode voltages of solution s (only fixed cells are read). Relaxed batch_lanes at a time
+    // in an interleaved [cell][lane] array so each stencil load of mask and indices serves every lane.
+    // Throws once a charge density is set: the space charge does not split into per-electrode terms.
+    static constexpr int batch_lanes = 4; // 4 doubles = one AVX2 register
+    std::vector<std::vector<double>> solveBatch(const std::vector<std::vector<double>> &fixed_values,
+                                                int max_iter = 1000, double tol = 1e-4) const;
+    template <int K, class Layout>
+    double relaxBatch(const Layout &L, const char *mask, std::vector<double> &V) const;
+    template <int K>
+    double relaxBatchCutCells(std::vector<double> &V) const;
+
+    // "row-major" (default) or "brick"; reorders whatever has been stored so far
+    void setLayout(const std::string &name);
+    std::vector<double> toRowMajor(const std::vector<double> &data) const;
+    std::vector<double> fromRowMajor(const std::vector<double> &data) const;
+
+    // Mirror symmetry about x = Lx/2 and/or y = Ly/2: the box only meshes the lower half of the
+    // full_nx x full_ny grid and the upper boundary becomes a Neumann mirror plane
+    void setSymmetry(bool mirror_x, bool mirror_y, int full_nx, int full_ny);
+    bool neighbourCell(int &i, int &j, int &k) const;
+    // Maps full-grid node or cell indices past a mirror plane onto their image in the meshed half;
+    // flip_x/flip_y, if given, become -1 where an index was reflected, the sign of the field component
+    // normal to that plane
+    void foldIndex(int &i, int &j, double *flip_x = nullptr, double *flip_y = nullptr) const;
+    std::vector<double> mirrorFaceValues() const;
+    void relaxMirrorFaces(const std::vector<double> &previous);
+    std::vector<double> unfoldedRowMajor(const std::vector<double> &data) const;
+
+    // Poisson mode: allocates the charge density (C/m^3) that enters the stencils as a source term
+    void enablePoisson();
+    // cloud-in-cell deposit of charge q at (x, y, z) on the full (unfolded) domain
+    void depositCharge(std::vector<double> &rho, double x, double y, double z, double q) const;
+
+    // E = -grad(potential) at every node into field_x/y/z (same indexing as potential): central
+    // differences between free nodes, second-order one-sided ones from the free side at electrode
+    // and outer faces, zero in electrode cells.
+    // Has to be called again whenever the potential changes.
+    void computeField();
+
+    // Cubic B-spline of the potential: prefiltered coefficients (one per node, same indexing as
+    // potential) so that the spline passes through every node value, and E = -grad of the spline,
+    // a C1 field. Each evaluation is a 4x4x4 dot product. (x, y) must lie in the meshed half.
+    void computeSplineCoefficients();
+    void splineField(double x, double y, double z, double &Ex, double &Ey, double &Ez, double *phi = nullptr) const;
+    void splineFieldBatch(size_t n, const double *x, const double *y, const double *z,
+                          double *Ex, double *Ey, double *Ez) const;
+
+    // Distance (m) from every node to the nearest electrode node: 0 on electrodes, infinite without
+    // any. Exact Euclidean distance transform in separable passes along z, y and x, parallel over the
+    // lines; across a mirror plane the lines are unfolded, so the reflected electrodes count too.
+    void computeElectrodeDistance();
+
+    // Batch probe for external tools: potential (V) and E (V/m) at n points of the full domain (m)
+    // read with the given interpolation, after computeField() (and computeSplineCoefficients() for
+    // B-splines). Points are visited sorted by cell, so neighbouring queries share cache lines, and
+    // spread over the threads; results keep the input order, NaN outside the box.
+    void probe(size_t n, const double *x, const double *y, const double *z, FieldInterpolation interpolation,
+               double *phi, double *Ex, double *Ey, double *Ez) const;
+
+    // Shortley-Weller boundaries: a free interior cell next to an electrode gets a stencil whose arms
+    // end on the electrode surface, located from the signed distances of the cell and its neighbour
+    struct CutCell
+    {
+        int idx;
+        std::array<int, 6> neighbour; // -1 where the arm ends on an electrode
+        std::array<double, 6> weight;
+        double boundary;              // weighted electrode potentials of the cut arms
+        double inv_diag;
+        std::array<int, 6> surface{-1, -1, -1, -1, -1, -1}; // electrode node of each cut arm (batched solves)
+    };
+    void buildCutCells();
+    void relaxCutCells();
+
+    // Partial-volume boundaries: the cells along the staircase surface are sub-sampled (samples^3
+    // points) for the fraction of their volume inside the electrodes, and the fractions on both
+    // sides of a cut arm place the Dirichlet surface for the cut-cell stencils (no distance needed)
+    void buildPartialVolumes(int samples = 4);
+    template <class ArmFraction>
+    void assembleCutCells(ArmFraction arm_fraction);
+
+    // Add geometry will be added next (e.g., addBox, addSphere)
+
+    const std::vector<double> &getPotential() const { return potential; }
+
+    std::vector<double> potential;
+    std::vector<double> geometry;
+    std::vector<char> fixed_mask;       // bytes, not vector<bool>, so threads can write neighbouring cells
+    std::vector<double> charge_density; // empty -> Laplace
+    std::vector<double> field_x, field_y, field_z; // E (V/m) from the last computeField()
+    std::vector<double> spline_coefficients;        // from the last computeSplineCoefficients()
+    std::vector<double> electrode_distance;         // from the last computeElectrodeDistance()
+    std::vector<int> label;             // which electrode owns a fixed cell
+    std::vector<Electrode> shapes;      // every primitive rasterized so far, in order
+    std::vector<double> signed_distance; // Shortley-Weller only: distance to the nearest electrode surface (< 0 inside) in the boundary band
+    std::vector<CutCell> cut_cells;
+    std::vector<double> volume_fraction; // partial-volume only: fraction of each cell inside an electrode (sampled in the boundary band)
+    int current_label = 0;
+    double potential_offset;
+
+    int win_i0, win_i1, win_j0, win_j1, win_k0, win_k1;
+
+    bool mirror_x = false, mirror_y = false;
+    int full_nx, full_ny;
+    double full_lx, full_ly;
+
+    bool brick_storage = false;
+    BrickLayout brick_layout;
+
+    int index(int i, int j, int k) const
+    {
+        return brick_storage ? brick_layout.index(i, j, k) : i * ny * nz + j * nz + k;
+    }
+
+    void applyJacobi();
+    void applyGaussSeidel();
+
+    // the sweeps are compiled once per layout so the hot loops never branch on it
+    template <class Layout>
+    void applyJacobi(const Layout &L);
+    template <class Layout>
+    void applyGaussSeidel(const Layout &L);
+};
+
+inline SimulationBox3D::SimulationBox3D(int nx, int ny, int nz,
+                                 double lx, double ly, double lz,
+                                 double potential_offset)
+    : nx(nx), ny(ny), nz(nz), lx(lx), ly(ly), lz(lz), potential_offset(potential_offset)
+{
+    dx = lx / (nx - 1);
+    dy = ly / (ny - 1);
+    dz = lz / (nz - 1);
+
+    int total_size = nx * ny * nz;
+    potential.resize(total_size, potential_offset);
+    geometry = potential;
+    fixed_mask.resize(total_size, false);
+    label.resize(total_size, 0);
+    resetWindow();
+
+    full_nx = nx;
+    full_ny = ny;
+    full_lx = lx;
+    full_ly = ly;
+}
+
+inline void SimulationBox3D::setSymmetry(bool mirror_x, bool mirror_y, int full_nx, int full_ny)
+{
+    this->mirror_x = mirror_x;
+    this->mirror_y = mirror_y;
+    this->full_nx = mirror_x ? full_nx : nx;
+    this->full_ny = mirror_y ? full_ny : ny;
+    full_lx = (this->full_nx - 1) * dx;
+    full_ly = (this->full_ny - 1) * dy;
+}
+
+// Maps a stencil neighbour onto a stored cell. Returns false past an ordinary boundary; past a mirror
+// plane the ghost cell is the reflection of the neighbour (the cell on the plane itself for odd full_nx,
+// the last stored cell when the plane falls between two nodes)
+inline bool SimulationBox3D::neighbourCell(int &i, int &j, int &k) const
+{
+    foldIndex(i, j);
+    return i >= 0 && j >= 0 && k >= 0 && i < nx && j < ny && k < nz;
+}
+
+inline void SimulationBox3D::foldIndex(int &i, int &j, double *flip_x, double *flip_y) const
+{
+    bool fold_x = mirror_x && i >= nx, fold_y = mirror_y && j >= ny;
+    if (fold_x)
+        i = full_nx - 1 - i;
+    if (fold_y)
+        j = full_ny - 1 - j;
+    if (flip_x)
+        *flip_x = fold_x ? -1.0 : 1.0;
+    if (flip_y)
+        *flip_y = fold_y ? -1.0 : 1.0;
+}
+
+inline std::vector<double> SimulationBox3D::mirrorFaceValues() const
+{
+    std::vector<double> values;
+    if (mirror_x)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+                values.push_back(potential[index(nx - 1, j, k)]);
+    if (mirror_y)
+        for (int i = 0; i < nx; ++i)
+            for (int k = 0; k < nz; ++k)
+                values.push_back(potential[index(i, ny - 1, k)]);
+    return values;
+}
+
+// The fixed-count face stencils of the sweeps know nothing about mirror planes. The plane cells get
+// their values from before the sweep back and are then relaxed with the reflected neighbour.
+inline void SimulationBox3D::relaxMirrorFaces(const std::vector<double> &previous)
+{
+    size_t n = 0;
+    if (mirror_x)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+                potential[index(nx - 1, j, k)] = previous[n++];
+    if (mirror_y)
+        for (int i = 0; i < nx; ++i)
+            for (int k = 0; k < nz; ++k)
+                potential[index(i, ny - 1, k)] = previous[n++];
+
+    if (mirror_x)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+                if (!fixed_mask[index(nx - 1, j, k)])
+                    potential[index(nx - 1, j, k)] = neighbourAverage(nx - 1, j, k);
+
+    if (mirror_y)
+        for (int i = 0; i < nx; ++i)
+            for (int k = 0; k < nz; ++k)
+                if (!fixed_mask[index(i, ny - 1, k)])
+                    potential[index(i, ny - 1, k)] = neighbourAverage(i, ny - 1, k);
+}
+
+// row-major data on the full (unfolded) grid, as the viewers expect it
+inline std::vector<double> SimulationBox3D::unfoldedRowMajor(const std::vector<double> &data) const
+{
+    if (!mirror_x && !mirror_y)
+        return toRowMajor(data);
+
+    std::vector<double> result(static_cast<size_t>(full_nx) * full_ny * nz);
+    for (int I = 0; I < full_nx; ++I)
+    {
+        for (int J = 0; J < full_ny; ++J)
+        {
+            int i = I, j = J;
+            foldIndex(i, j);
+            for (int k = 0; k < nz; ++k)
+                result[(static_cast<size_t>(I) * full_ny + J) * nz + k] = data[index(i, j, k)];
+        }
+    }
+    return result;
+}
+
+inline void SimulationBox3D::setWindow(int i0, int i1, int j0, int j1, int k0, int k1)
+{
+    win_i0 = std::max(i0, 0);
+    win_i1 = std::min(i1, nx - 1);
+    win_j0 = std::max(j0, 0);
+    win_j1 = std::min(j1, ny - 1);
+    win_k0 = std::max(k0, 0);
+    win_k1 = std::min(k1, nz - 1);
+}
+
+inline void SimulationBox3D::resetWindow()
+{
+    setWindow(0, nx - 1, 0, ny - 1, 0, nz - 1);
+}
+
+// same stencils as the sweeps: mean of the neighbours that exist (6 inside, 5 on faces, 4 on edges, 3 at corners)
+inline double SimulationBox3D::neighbourAverage(int i, int j, int k) const
+{
+    double sum = 0.0;
+    int count = 0;
+    const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    for (const auto &o : offsets)
+    {
+        int ii = i + o[0], jj = j + o[1], kk = k + o[2];
+        if (neighbourCell(ii, jj, kk))
+        {
+            sum += potential[index(ii, jj, kk)];
+            ++count;
+        }
+    }
+
+    if (!charge_density.empty())
+        sum += charge_density[index(i, j, k)] * (dx * dx + dy * dy + dz * dz) / (3.0 * eps0) * count / 6.0;
+
+    return sum / count;
+}
+
+inline bool SimulationBox3D::relaxLocal(int i0, int i1, int j0, int j1, int k0, int k1, double tol,
+                                        long long max_updates, long long &updates)
+{
+    // work list of row-major cell numbers; a cell that moves by more than tol re-queues its neighbours
+    std::deque<int> queue;
+    std::vector<char> queued(static_cast<size_t>(nx) * ny * nz, 0);
+    auto push = [&](int i, int j, int k)
+    {
+        if (i < 0 || j < 0 || k < 0 || i >= nx || j >= ny || k >= nz)
+            return;
+        int id = (i * ny + j) * nz + k;
+        if (queued[id] || fixed_mask[index(i, j, k)])
+            return;
+        queued[id] = 1;
+        queue.push_back(id);
+    };
+
+    for (int i = i0 - 1; i <= i1 + 1; ++i)
+        for (int j = j0 - 1; j <= j1 + 1; ++j)
+            for (int k = k0 - 1; k <= k1 + 1; ++k)
+                push(i, j, k);
+
+    updates = 0;
+    while (!queue.empty() && updates < max_updates)
+    {
+        int id = queue.front();
+        queue.pop_front();
+        queued[id] = 0;
+
+        int i = id / (ny * nz), j = (id / nz) % ny, k = id % nz;
+        int idx = index(i, j, k);
+        double updated = neighbourAverage(i, j, k);
+        double change = std::abs(updated - potential[idx]);
+        potential[idx] = updated;
+        ++updates;
+
+        if (change > tol)
+        {
+            push(i - 1, j, k);
+            push(i + 1, j, k);
+            push(i, j - 1, k);
+            push(i, j + 1, k);
+            push(i, j, k - 1);
+            push(i, j, k + 1);
+        }
+    }
+    return queue.empty();
+}
+
+inline void SimulationBox3D::solve(int max_iter, double tol, const std::string &method)
+{
+    std::vector<double> V_old = potential;
+    std::vector<double> V_new = potential;
+
+    if (method != "jacobi" && method != "gauss-seidel")
+        throw std::runtime_error("Unknown method");
+
+    // cut cells are held by the regular sweeps and relaxed with their own stencil after each one
+    for (const CutCell &cell : cut_cells)
+        fixed_mask[cell.idx] = 1;
+
+    for (int iter = 0; iter < max_iter; ++iter)
+    {
+        V_old = potential;
+
+        if (method == "jacobi")
+        {
+            applyJacobi();
+        }
+        else if (method == "gauss-seidel")
+        {
+            applyGaussSeidel();
+        }
+        else
+        {
+            throw std::runtime_error("Unknown method");
+        }
+        if (!cut_cells.empty())
+            relaxCutCells();
+
+        // Check for convergence
+        double max_diff = 0.0;
+        for (size_t i = 0; i < potential.size(); ++i)
+        {
+            max_diff = std::max(max_diff, std::abs(potential[i] - V_old[i]));
+        }
+
+        std::cout << "Iteration " << iter << ", Max Diff = " << max_diff << std::endl;
+
+        if (max_diff <= tol)
+        {
+            std::cout << "Converged at iteration " << iter << std::endl;
+            break;
+        }
+    }
+
+    for (const CutCell &cell : cut_cells)
+        fixed_mask[cell.idx] = 0;
+}
+
+inline void SimulationBox3D::setLayout(const std::string &name)
+{
+    bool want_bricks = (name == "brick");
+    if (!want_bricks && name != "row-major")
+        throw std::runtime_error("Unknown layout: " + name);
+    if (want_bricks == brick_storage)
+        return;
+
+    std::vector<double> potential_rm = toRowMajor(potential);
+    std::vector<double> geometry_rm = toRowMajor(geometry);
+    std::vector<double> charge_rm = charge_density.empty() ? std::vector<double>() : toRowMajor(charge_density);
+    std::vector<bool> mask_rm(static_cast<size_t>(nx) * ny * nz);
+    std::vector<int> label_rm(mask_rm.size());
+    for (int i = 0; i < nx; ++i)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+            {
+                mask_rm[(static_cast<size_t>(i) * ny + j) * nz + k] = fixed_mask[index(i, j, k)];
+                label_rm[(static_cast<size_t>(i) * ny + j) * nz + k] = label[index(i, j, k)];
+            }
+
+    brick_storage = want_bricks;
+    if (brick_storage)
+        brick_layout = BrickLayout(nx, ny, nz);
+
+    potential = fromRowMajor(potential_rm);
+    geometry = fromRowMajor(geometry_rm);
+    if (!charge_rm.empty())
+        charge_density = fromRowMajor(charge_rm);
+
+    size_t total_size = brick_storage ? brick_layout.size() : mask_rm.size();
+    fixed_mask.assign(total_size, false);
+    label.assign(total_size, 0);
+    for (int i = 0; i < nx; ++i)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+            {
+                fixed_mask[index(i, j, k)] = mask_rm[(static_cast<size_t>(i) * ny + j) * nz + k];
+                label[index(i, j, k)] = label_rm[(static_cast<size_t>(i) * ny + j) * nz + k];
+            }
+}
+
+inline std::vector<double> SimulationBox3D::toRowMajor(const std::vector<double> &data) const
+{
+    if (!brick_storage)
+        return data;
+
+    std::vector<double> result(static_cast<size_t>(nx) * ny * nz);
+    for (int i = 0; i < nx; ++i)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+                result[(static_cast<size_t>(i) * ny + j) * nz + k] = data[index(i, j, k)];
+    return result;
+}
+
+inline std::vector<double> SimulationBox3D::fromRowMajor(const std::vector<double> &data) const
+{
+    if (!brick_storage)
+        return data;
+
+    // padding cells of partial bricks keep the first value; they are never read by the stencils
+    std::vector<double> result(brick_layout.size(), data.empty() ? 0.0 : data[0]);
+    for (int i = 0; i < nx; ++i)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+                result[index(i, j, k)] = data[(static_cast<size_t>(i) * ny + j) * nz + k];
+    return result;
+}
+
+inline void SimulationBox3D::enablePoisson()
+{
+    charge_density.assign(potential.size(), 0.0);
+}
+
+inline void SimulationBox3D::computeField()
+{
+    field_x.assign(potential.size(), 0.0);
+    field_y.assign(potential.size(), 0.0);
+    field_z.assign(potential.size(), 0.0);
+
+    // derivative along one axis at a free node (h = spacing). Differences only reach across free
+    // nodes: at an electrode face or an outer face they are one-sided from the free side (second
+    // order when two free nodes are available). Past a mirror plane neighbourCell supplies the ghost
+    // node. A node squeezed between two electrodes keeps the central difference across them.
+    auto component = [this](int i, int j, int k, int di, int dj, int dk, double h)
+    {
+        auto value = [&](int steps, bool &exists, bool &free)
+        {
+            int ii = i + steps * di, jj = j + steps * dj, kk = k + steps * dk;
+            exists = neighbourCell(ii, jj, kk);
+            if (!exists)
+            {
+                free = false;
+                return 0.0;
+            }
+            int idx = index(ii, jj, kk);
+            free = !fixed_mask[idx];
+            return potential[idx];
+        };
+        bool has_plus, has_minus, plus_free, minus_free, has2, free2;
+        double v0 = potential[index(i, j, k)];
+        double vp = value(1, has_plus, plus_free);
+        double vm = value(-1, has_minus, minus_free);
+        if (plus_free && minus_free)
+            return -(vp - vm) / (2.0 * h);
+        if (plus_free)
+        {
+            double vp2 = value(2, has2, free2);
+            return free2 ? -(-3.0 * v0 + 4.0 * vp - vp2) / (2.0 * h) : -(vp - v0) / h;
+        }
+        if (minus_free)
+        {
+            double vm2 = value(-2, has2, free2);
+            return free2 ? -(3.0 * v0 - 4.0 * vm + vm2) / (2.0 * h) : -(v0 - vm) / h;
+        }
+        if (has_plus && has_minus)
+            return -(vp - vm) / (2.0 * h);
+        if (has_plus)
+            return -(vp - v0) / h;
+        if (has_minus)
+            return -(v0 - vm) / h;
+        return 0.0;
+    };
+
+    parallel_for(0, nx, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+            for (int j = 0; j < ny; ++j)
+                for (int k = 0; k < nz; ++k)
+                {
+                    int idx = index(i, j, k);
+                    if (fixed_mask[idx])
+                        continue; // no field inside a conductor
+                    field_x[idx] = component(i, j, k, 1, 0, 0, dx);
+                    field_y[idx] = component(i, j, k, 0, 1, 0, dy);
+                    field_z[idx] = component(i, j, k, 0, 0, 1, dz);
+                }
+    });
+}
+
+// In-place cubic B-spline prefilter of one line of samples with mirror (whole-sample symmetric)
+// ends: one causal and one anticausal pass of the recursive filter with pole sqrt(3) - 2
+static void bspline_prefilter(std::vector<double> &c)
+{
+    const size_t n = c.size();
+    if (n < 2)
+        return;
+    const double z = std::sqrt(3.0) - 2.0;
+    for (double &v : c)
+        v *= 6.0;
+
+    // causal initial value: truncated geometric sum, or the exact mirrored sum for short lines
+    const size_t horizon = 30; // |z|^30 < 1e-17
+    double sum;
+    if (horizon < n)
+    {
+        double zn = z;
+        sum = c[0];
+        for (size_t k = 1; k < horizon; ++k)
+        {
+            sum += zn * c[k];
+            zn *= z;
+        }
+    }
+    else
+    {
+        double zn = z, iz = 1.0 / z, z2n = std::pow(z, static_cast<double>(n - 1));
+        sum = c[0] + z2n * c[n - 1];
+        z2n *= z2n * iz;
+        for (size_t k = 1; k + 1 < n; ++k)
+        {
+            sum += (zn + z2n) * c[k];
+            zn *= z;
+            z2n *= iz;
+        }
+        sum /= 1.0 - zn * zn;
+    }
+    c[0] = sum;
+    for (size_t k = 1; k < n; ++k)
+        c[k] += z * c[k - 1];
+
+    c[n - 1] = (z / (z * z - 1.0)) * (c[n - 1] + z * c[n - 2]);
+    for (size_t k = n - 1; k-- > 0;)
+        c[k] = z * (c[k + 1] - c[k]);
+}
+
+inline void SimulationBox3D::computeSplineCoefficients()
+{
+    spline_coefficients = potential;
+
+    // one separable pass per axis; across a mirror plane each line is unfolded to the full box first
+    auto filter_lines = [this](int n, int full_n, int axis)
+    {
+        int outer = axis == 0 ? ny : nx;
+        int inner = axis == 2 ? ny : nz;
+        parallel_for(0, outer, [&](int first, int last)
+        {
+            std::vector<double> line(full_n);
+            for (int a = first; a < last; ++a)
+                for (int b = 0; b < inner; ++b)
+                {
+                    auto node = [&](int m)
+                    {
+                        if (axis == 0)
+                            return index(m, a, b);
+                        if (axis == 1)
+                            return index(a, m, b);
+                        return index(a, b, m);
+                    };
+                    for (int m = 0; m < full_n; ++m)
+                        line[m] = spline_coefficients[node(m < n ? m : full_n - 1 - m)];
+                    bspline_prefilter(line);
+                    for (int m = 0; m < n; ++m)
+                        spline_coefficients[node(m)] = line[m];
+                }
+        });
+    };
+    filter_lines(nx, full_nx, 0);
+    filter_lines(ny, full_ny, 1);
+    filter_lines(nz, nz, 2);
+}
+
+// One line of the squared distance transform (Felzenszwalb-Huttenlocher): f[p] becomes
+// min_q w (p - q)^2 + f[q], the lower envelope of the parabolas rooted at the finite samples,
+// with w the squared node spacing. v and z hold the envelope, out is scratch (all sized like f).
+static void squared_distance_line(std::vector<double> &f, double w, std::vector<int> &v, std::vector<double> &z,
+                                  std::vector<double> &out)
+{
+    const int n = static_cast<int>(f.size());
+    int k = -1;
+    for (int q = 0; q < n; ++q)
+    {
+        if (f[q] == unbounded)
+            continue;
+        // drop the parabolas that the new one hides, then append it
+        double s = -unbounded;
+        while (k >= 0)
+        {
+            int r = v[k];
+            s = ((f[q] + w * q * q) - (f[r] + w * r * r)) / (2.0 * w * (q - r));
+            if (s > z[k])
+                break;
+            --k;
+        }
+        ++k;
+        v[k] = q;
+        z[k] = (k == 0) ? -unbounded : s;
+    }
+    if (k < 0)
+        return; // no electrode on this line (yet): stays infinite
+
+    for (int p = 0, j = 0; p < n; ++p)
+    {
+        while (j < k && z[j + 1] < p)
+            ++j;
+        out[p] = w * (p - v[j]) * (p - v[j]) + f[v[j]];
+    }
+    f.swap(out);
+}
+
+inline void SimulationBox3D::computeElectrodeDistance()
+{
+    electrode_distance.assign(potential.size(), unbounded);
+    for (size_t n = 0; n < potential.size(); ++n)
+        if (fixed_mask[n])
+            electrode_distance[n] = 0.0;
+
+    // same line traversal as the spline prefilter: lines past a mirror plane read their image
+    auto transform_lines = [this](int n, int full_n, int axis, double spacing)
+    {
+        int outer = axis == 0 ? ny : nx;
+        int inner = axis == 2 ? ny : nz;
+        parallel_for(0, outer, [&](int first, int last)
+        {
+            std::vector<double> line(full_n), z(full_n), out(full_n);
+            std::vector<int> v(full_n);
+            for (int a = first; a < last; ++a)
+                for (int b = 0; b < inner; ++b)
+                {
+                    auto node = [&](int m)
+                    {
+                        if (axis == 0)
+                            return index(m, a, b);
+                        if (axis == 1)
+                            return index(a, m, b);
+                        return index(a, b, m);
+                    };
+                    for (int m = 0; m < full_n; ++m)
+                        line[m] = electrode_distance[node(m < n ? m : full_n - 1 - m)];
+                    squared_distance_line(line, spacing * spacing, v, z, out);
+                    for (int m = 0; m < n; ++m)
+                        electrode_distance[node(m)] = line[m];
+                }
+        });
+    };
+    transform_lines(nz, nz, 2, dz);
+    transform_lines(ny, full_ny, 1, dy);
+    transform_lines(nx, full_nx, 0, dx);
+
+    parallel_for(0, static_cast<int>(electrode_distance.size()), [this](int first, int last)
+    {
+        for (int n = first; n < last; ++n)
+            electrode_distance[n] = std::sqrt(electrode_distance[n]);
+    });
+}
+
+inline void SimulationBox3D::splineField(double x, double y, double z, double &Ex, double &Ey, double &Ez,
+                                         double *phi) const
+{
+    // base node, B-spline weights and their derivatives for the 4 nodes base-1 .. base+2 of one axis
+    auto axis_weights = [](double u, int full_n, int stored_n, int *nodes, double *w, double *d)
+    {
+        int base = std::clamp(static_cast<int>(std::floor(u)), 0, std::max(full_n - 2, 0));
+        double t = u - base, t2 = t * t, t3 = t2 * t, s = 1.0 - t;
+        w[0] = s * s * s / 6.0;
+        w[1] = (4.0 - 6.0 * t2 + 3.0 * t3) / 6.0;
+        w[2] = (1.0 + 3.0 * t + 3.0 * t2 - 3.0 * t3) / 6.0;
+        w[3] = t3 / 6.0;
+        d[0] = -0.5 * s * s;
+        d[1] = 1.5 * t2 - 2.0 * t;
+        d[2] = 0.5 + t - 1.5 * t2;
+        d[3] = 0.5 * t2;
+        for (int m = 0; m < 4; ++m)
+        {
+            // mirror ends of the full line, then fold the upper half of a mirrored box
+            int node = base - 1 + m;
+            if (node < 0)
+                node = -node;
+            if (node > full_n - 1)
+                node = 2 * (full_n - 1) - node;
+            node = std::clamp(node, 0, full_n - 1);
+            nodes[m] = node < stored_n ? node : full_n - 1 - node;
+        }
+    };
+
+    int ni[4], nj[4], nk[4];
+    double wx[4], wy[4], wz[4], gx[4], gy[4], gz[4];
+    axis_weights(x / dx, full_nx, nx, ni, wx, gx);
+    axis_weights(y / dy, full_ny, ny, nj, wy, gy);
+    axis_weights(z / dz, nz, nz, nk, wz, gz);
+
+    double sx = 0.0, sy = 0.0, sz = 0.0, s = 0.0;
+    for (int a = 0; a < 4; ++a)
+        for (int b = 0; b < 4; ++b)
+        {
+            // the z sums are shared by all three components (and the value)
+            double value = 0.0, slope = 0.0;
+            for (int c = 0; c < 4; ++c)
+            {
+                double coefficient = spline_coefficients[index(ni[a], nj[b], nk[c])];
+                value += coefficient * wz[c];
+                slope += coefficient * gz[c];
+            }
+            sx += gx[a] * wy[b] * value;
+            sy += wx[a] * gy[b] * value;
+            sz += wx[a] * wy[b] * slope;
+            s += wx[a] * wy[b] * value;
+        }
+    Ex = -sx / dx;
+    Ey = -sy / dy;
+    Ez = -sz / dz;
+    if (phi)
+        *phi = s;
+}
+
+inline void SimulationBox3D::splineFieldBatch(size_t n, const double *x, const double *y, const double *z,
+                                              double *Ex, double *Ey, double *Ez) const
+{
+    parallel_for(0, static_cast<int>(n), [&](int first, int last)
+    {
+        for (int p = first; p < last; ++p)
+            splineField(x[p], y[p], z[p], Ex[p], Ey[p], Ez[p]);
+    });
+}
+
+// Trilinear interpolation of the precomputed field at (x, y, z) inside the meshed half of the box.
+// Electrode nodes carry no field and are left out of the weights, so the field next to an electrode
+// surface is not pulled towards zero; past a mirror plane the ghost nodes flip the normal component.
+template <class Layout>
+void trilinear_field(const Layout &L, const SimulationBox3D &box, double x, double y, double z,
+                     double &Ex, double &Ey, double &Ez)
+{
+    double fx = x / box.dx, fy = y / box.dy, fz = z / box.dz;
+    int i0 = std::clamp(static_cast<int>(fx), 0, box.mirror_x ? box.nx - 1 : box.nx - 2);
+    int j0 = std::clamp(static_cast<int>(fy), 0, box.mirror_y ? box.ny - 1 : box.ny - 2);
+    int k0 = std::clamp(static_cast<int>(fz), 0, box.nz - 2);
+    double tx = fx - i0, ty = fy - j0, tz = fz - k0;
+
+    double sum_x = 0.0, sum_y = 0.0, sum_z = 0.0, weight_sum = 0.0;
+    for (int c = 0; c < 8; ++c)
+    {
+        int di = c & 1, dj = c >> 1 & 1, dk = c >> 2 & 1;
+        int i = i0 + di, j = j0 + dj, k = k0 + dk;
+        double flip_x = (i >= box.nx) ? -1.0 : 1.0, flip_y = (j >= box.ny) ? -1.0 : 1.0;
+        box.neighbourCell(i, j, k);
+        int idx = L.index(i, j, k);
+        if (box.fixed_mask[idx])
+            continue;
+        double w = (di ? tx : 1.0 - tx) * (dj ? ty : 1.0 - ty) * (dk ? tz : 1.0 - tz);
+        sum_x += w * flip_x * box.field_x[idx];
+        sum_y += w * flip_y * box.field_y[idx];
+        sum_z += w * box.field_z[idx];
+        weight_sum += w;
+    }
+    if (weight_sum > 0.0)
+    {
+        Ex = sum_x / weight_sum;
+        Ey = sum_y / weight_sum;
+        Ez = sum_z / weight_sum;
+    }
+    else
+        Ex = Ey = Ez = 0.0;
+}
+
+// Trilinear or B-spline field at a point of the full domain: the position itself is folded into the
+// meshed half and the component normal to a mirror plane flips back
+template <class Layout>
+void interpolated_field(const Layout &L, const SimulationBox3D &box, FieldInterpolation interpolation,
+                        double x, double y, double z, double &Ex, double &Ey, double &Ez)
+{
+    double px = x, py = y;
+    if (box.mirror_x && px > 0.5 * box.full_lx)
+        px = box.full_lx - px;
+    if (box.mirror_y && py > 0.5 * box.full_ly)
+        py = box.full_ly - py;
+    if (interpolation == FieldInterpolation::Trilinear)
+        trilinear_field(L, box, px, py, z, Ex, Ey, Ez);
+    else
+        box.splineField(px, py, z, Ex, Ey, Ez);
+    Ex *= (px != x) ? -1.0 : 1.0;
+    Ey *= (py != y) ? -1.0 : 1.0;
+}
+
+// Trilinear potential at a point of the full domain (electrode nodes included, they hold their voltage)
+template <class Layout>
+double interpolated_potential(const Layout &L, const SimulationBox3D &box, double x, double y, double z)
+{
+    if (box.mirror_x && x > 0.5 * box.full_lx)
+        x = box.full_lx - x;
+    if (box.mirror_y && y > 0.5 * box.full_ly)
+        y = box.full_ly - y;
+    double fx = x / box.dx, fy = y / box.dy, fz = z / box.dz;
+    int i0 = std::clamp(static_cast<int>(fx), 0, box.mirror_x ? box.nx - 1 : box.nx - 2);
+    int j0 = std::clamp(static_cast<int>(fy), 0, box.mirror_y ? box.ny - 1 : box.ny - 2);
+    int k0 = std::clamp(static_cast<int>(fz), 0, box.nz - 2);
+    double tx = fx - i0, ty = fy - j0, tz = fz - k0;
+
+    double sum = 0.0;
+    for (int c = 0; c < 8; ++c)
+    {
+        int di = c & 1, dj = c >> 1 & 1, dk = c >> 2 & 1;
+        int i = i0 + di, j = j0 + dj, k = k0 + dk;
+        box.neighbourCell(i, j, k);
+        sum += (di ? tx : 1.0 - tx) * (dj ? ty : 1.0 - ty) * (dk ? tz : 1.0 - tz) * box.potential[L.index(i, j, k)];
+    }
+    return sum;
+}
+
+// Worker of SimulationBox3D::probe, compiled per layout
+template <class Layout>
+void probe_points(const Layout &L, const SimulationBox3D &box, size_t n, const double *x, const double *y,
+                  const double *z, FieldInterpolation interpolation, double *phi, double *Ex, double *Ey, double *Ez)
+{
+    // storage index of each point's cell (folded into the meshed half) as the sort key
+    std::vector<std::pair<int, size_t>> order;
+    order.reserve(n);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (size_t p = 0; p < n; ++p)
+    {
+        if (!(x[p] >= 0 && x[p] <= box.full_lx && y[p] >= 0 && y[p] <= box.full_ly && z[p] >= 0 && z[p] <= box.lz))
+        {
+            phi[p] = Ex[p] = Ey[p] = Ez[p] = nan;
+            continue;
+        }
+        int i = std::min(static_cast<int>(x[p] / box.dx), box.full_nx - 1);
+        int j = std::min(static_cast<int>(y[p] / box.dy), box.full_ny - 1);
+        int k = std::min(static_cast<int>(z[p] / box.dz), box.nz - 1);
+        box.foldIndex(i, j);
+        order.emplace_back(L.index(i, j, k), p);
+    }
+    std::sort(order.begin(), order.end());
+
+    parallel_for(0, static_cast<int>((order.size() + 1023) / 1024), [&](int first, int last)
+    {
+        size_t end = std::min(order.size(), static_cast<size_t>(last) * 1024);
+        for (size_t s = static_cast<size_t>(first) * 1024; s < end; ++s)
+        {
+            auto [idx, p] = order[s];
+            if (interpolation == FieldInterpolation::Nearest)
+            {
+                // the pusher's field of the enclosing cell, and the potential of its base node
+                phi[p] = box.potential[idx];
+                Ex[p] = (box.mirror_x && x[p] / box.dx >= box.nx) ? -box.field_x[idx] : box.field_x[idx];
+                Ey[p] = (box.mirror_y && y[p] / box.dy >= box.ny) ? -box.field_y[idx] : box.field_y[idx];
+                Ez[p] = box.field_z[idx];
+            }
+            else if (interpolation == FieldInterpolation::Trilinear)
+            {
+                phi[p] = interpolated_potential(L, box, x[p], y[p], z[p]);
+                interpolated_field(L, box, interpolation, x[p], y[p], z[p], Ex[p], Ey[p], Ez[p]);
+            }
+            else
+            {
+                // fold as interpolated_field does, but take the spline value from the same pass
+                double px = (box.mirror_x && x[p] > 0.5 * box.full_lx) ? box.full_lx - x[p] : x[p];
+                double py = (box.mirror_y && y[p] > 0.5 * box.full_ly) ? box.full_ly - y[p] : y[p];
+                box.splineField(px, py, z[p], Ex[p], Ey[p], Ez[p], &phi[p]);
+                Ex[p] *= (px != x[p]) ? -1.0 : 1.0;
+                Ey[p] *= (py != y[p]) ? -1.0 : 1.0;
+            }
+        }
+    });
+}
+
+inline void SimulationBox3D::probe(size_t n, const double *x, const double *y, const double *z,
+                                   FieldInterpolation interpolation, double *phi, double *Ex, double *Ey, double *Ez) const
+{
+    if (field_x.size() != potential.size())
+        throw std::runtime_error("E field not computed: call computeField() after solving");
+    if (interpolation == FieldInterpolation::Bspline && spline_coefficients.size() != potential.size())
+        throw std::runtime_error("B-spline not computed: call computeSplineCoefficients() after solving");
+    if (brick_storage)
+        probe_points(brick_layout, *this, n, x, y, z, interpolation, phi, Ex, Ey, Ez);
+    else
+        probe_points(RowMajorLayout(nx, ny, nz), *this, n, x, y, z, interpolation, phi, Ex, Ey, Ez);
+}
+
+// cloud-in-cell: share the charge q between the 8 nodes around (x, y, z)
+inline void SimulationBox3D::depositCharge(std::vector<double> &rho, double x, double y, double z, double q) const
+{
+    double fx = x / dx, fy = y / dy, fz = z / dz;
+    if (fx < 0 || fy < 0 || fz < 0 || fx > full_nx - 1 || fy > full_ny - 1 || fz > nz - 1)
+        return;
+    // the meshed half of a mirrored axis holds the symmetric part (rho(x) + rho(L - x)) / 2, so the
+    // particle is folded into it and shares each weight with its image (see the loop below)
+    if (mirror_x)
+        fx = std::min(fx, full_nx - 1 - fx);
+    if (mirror_y)
+        fy = std::min(fy, full_ny - 1 - fy);
+
+    int i = static_cast<int>(fx), j = static_cast<int>(fy), k = static_cast<int>(fz);
+    // a particle on an upper face deposits onto the face nodes from the last cell; past a mirror plane
+    // the stencil reaches into the ghost nodes instead
+    if (!mirror_x)
+        i = std::min(i, nx - 2);
+    if (!mirror_y)
+        j = std::min(j, ny - 2);
+    k = std::min(k, nz - 2);
+
+    double wx[2] = {1 - (fx - i), fx - i}, wy[2] = {1 - (fy - j), fy - j}, wz[2] = {1 - (fz - k), fz - k};
+    double q_per_volume = q / (dx * dy * dz);
+
+    for (int a = 0; a < 2; ++a)
+        for (int b = 0; b < 2; ++b)
+            for (int c = 0; c < 2; ++c)
+            {
+                int ii = i + a, jj = j + b, kk = k + c;
+                if (!neighbourCell(ii, jj, kk))
+                    continue;
+                // half the weight belongs to the image; a node on the plane is its own image and keeps all of it
+                double w = wx[a] * wy[b] * wz[c];
+                if (mirror_x && ii != full_nx - 1 - ii)
+                    w *= 0.5;
+                if (mirror_y && jj != full_ny - 1 - jj)
+                    w *= 0.5;
+                rho[index(ii, jj, kk)] += q_per_volume * w;
+            }
+}
+
+inline std::vector<std::vector<double>> SimulationBox3D::solveBatch(const std::vector<std::vector<double>> &fixed_values,
+                                                             int max_iter, double tol) const
+{
+    constexpr int K = batch_lanes;
+    size_t n_cells = potential.size();
+    std::vector<std::vector<double>> solutions(fixed_values.size());
+    if (!charge_density.empty())
+        throw std::runtime_error("Batched solve is Laplace only, it cannot run with a charge density");
+
+    // as in solve(): the cut cells are held by the regular sweep and relaxed with their own stencil
+    std::vector<char> held;
+    const char *mask = fixed_mask.data();
+    if (!cut_cells.empty())
+    {
+        held = fixed_mask;
+        for (const CutCell &cell : cut_cells)
+            held[cell.idx] = 1;
+        mask = held.data();
+    }
+
+    for (size_t first = 0; first < fixed_values.size(); first += K)
+    {
+        // interleave: V[idx*K + s]; unused lanes of the last group just relax zeros
+        std::vector<double> V(n_cells * K, 0.0);
+        for (size_t idx = 0; idx < n_cells; ++idx)
+            for (int s = 0; s < K && first + s < fixed_values.size(); ++s)
+                V[idx * K + s] = fixed_values[first + s][idx];
+
+        for (int iter = 0; iter < max_iter; ++iter)
+        {
+            double max_diff = brick_storage ? relaxBatch<K>(brick_layout, mask, V)
+                                            : relaxBatch<K>(RowMajorLayout(nx, ny, nz), mask, V);
+            if (!cut_cells.empty())
+                max_diff = std::max(max_diff, relaxBatchCutCells<K>(V));
+            if (max_diff <= tol)
+            {
+                std::cout << "Batch " << first / K << " converged at iteration " << iter << std::endl;
+                break;
+            }
+        }
+
+        for (int s = 0; s < K && first + s < fixed_values.size(); ++s)
+        {
+            solutions[first + s].resize(n_cells);
+            for (size_t idx = 0; idx < n_cells; ++idx)
+                solutions[first + s][idx] = V[idx * K + s];
+        }
+    }
+    return solutions;
+}
+
+// one Gauss-Seidel sweep over all K interleaved solutions, returns the largest change
+template <int K, class Layout>
+double SimulationBox3D::relaxBatch(const Layout &L, const char *mask, std::vector<double> &V) const
+{
+    double max_diff = 0.0;
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            for (int k = 1; k < nz - 1; ++k)
+            {
+                int idx = L.index(i, j, k);
+                if (mask[idx])
+                    continue;
+
+                const double *xp = &V[static_cast<size_t>(L.index(i + 1, j, k)) * K];
+                const double *xm = &V[static_cast<size_t>(L.index(i - 1, j, k)) * K];
+                const double *yp = &V[static_cast<size_t>(L.index(i, j + 1, k)) * K];
+                const double *ym = &V[static_cast<size_t>(L.index(i, j - 1, k)) * K];
+                const double *zp = &V[static_cast<size_t>(L.index(i, j, k + 1)) * K];
+                const double *zm = &V[static_cast<size_t>(L.index(i, j, k - 1)) * K];
+                double *out = &V[static_cast<size_t>(idx) * K];
+
+                for (int s = 0; s < K; ++s)
+                {
+                    double updated = (1.0 / 6.0) * (xp[s] + xm[s] + yp[s] + ym[s] + zp[s] + zm[s]);
+                    max_diff = std::max(max_diff, std::abs(updated - out[s]));
+                    out[s] = updated;
+                }
+            }
+        }
+    }
+
+    // faces, edges and corners: mean of the neighbours that exist, as in the single solve
+    auto relax_boundary = [&](int i, int j, int k)
+    {
+        int idx = L.index(i, j, k);
+        if (mask[idx])
+            return;
+
+        double sum[K] = {};
+        int count = 0;
+        auto add = [&](int ii, int jj, int kk)
+        {
+            if (!neighbourCell(ii, jj, kk))
+                return;
+            const double *nb = &V[static_cast<size_t>(L.index(ii, jj, kk)) * K];
+            for (int s = 0; s < K; ++s)
+                sum[s] += nb[s];
+            ++count;
+        };
+        add(i - 1, j, k);
+        add(i + 1, j, k);
+        add(i, j - 1, k);
+        add(i, j + 1, k);
+        add(i, j, k - 1);
+        add(i, j, k + 1);
+
+        double *out = &V[static_cast<size_t>(idx) * K];
+        for (int s = 0; s < K; ++s)
+        {
+            double updated = sum[s] / count;
+            max_diff = std::max(max_diff, std::abs(updated - out[s]));
+            out[s] = updated;
+        }
+    };
+
+    for (int j = 0; j < ny; ++j)
+        for (int k = 0; k < nz; ++k)
+        {
+            relax_boundary(0, j, k);
+            relax_boundary(nx - 1, j, k);
+        }
+    for (int i = 1; i < nx - 1; ++i)
+        for (int k = 0; k < nz; ++k)
+        {
+            relax_boundary(i, 0, k);
+            relax_boundary(i, ny - 1, k);
+        }
+    for (int i = 1; i < nx - 1; ++i)
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            relax_boundary(i, j, 0);
+            relax_boundary(i, j, nz - 1);
+        }
+
+    return max_diff;
+}
+
+// cut-cell stencils of every lane; the arms that end on an electrode read that lane's voltage there
+template <int K>
+double SimulationBox3D::relaxBatchCutCells(std::vector<double> &V) const
+{
+    double max_diff = 0.0;
+    for (const CutCell &cell : cut_cells)
+    {
+        double sum[K] = {};
+        for (int n = 0; n < 6; ++n)
+        {
+            const double *nb = &V[static_cast<size_t>(cell.neighbour[n] >= 0 ? cell.neighbour[n] : cell.surface[n]) * K];
+            for (int s = 0; s < K; ++s)
+                sum[s] += cell.weight[n] * nb[s];
+        }
+
+        double *out = &V[static_cast<size_t>(cell.idx) * K];
+        for (int s = 0; s < K; ++s)
+        {
+            double updated = sum[s] * cell.inv_diag;
+            max_diff = std::max(max_diff, std::abs(updated - out[s]));
+            out[s] = updated;
+        }
+    }
+    return max_diff;
+}
+
+// Inclusive range of node indices n with lo <= n*h <= hi, widened by one node against rounding
+// (the exact inside tests still run on every node) and clipped to [w0, w1]; lo/hi may be infinite
+static void node_range(double lo, double hi, double h, int w0, int w1, int &n0, int &n1)
+{
+    n0 = static_cast<int>(std::clamp(std::floor(lo / h) - 1.0, static_cast<double>(w0), w1 + 1.0));
+    n1 = static_cast<int>(std::clamp(std::ceil(hi / h) + 1.0, w0 - 1.0, static_cast<double>(w1)));
+}
+
+// Fused rasterization of a list of electrodes inside the current window. The i range is split
+// into one slab per thread and every slab only tests the electrodes whose bounds reach it. Within
+// a column the electrodes are painted in list order, so a later entry overwrites an earlier one
+// exactly as separate add* calls would, independent of the thread count.
+inline void SimulationBox3D::rasterize(const std::vector<Electrode> &electrodes)
+{
+    shapes.insert(shapes.end(), electrodes.begin(), electrodes.end());
+
+    struct NodeBox
+    {
+        int i0, i1, j0, j1, k0, k1;
+    };
+    std::vector<NodeBox> nodes(electrodes.size());
+    for (size_t n = 0; n < electrodes.size(); ++n)
+    {
+        const Electrode &e = electrodes[n];
+        NodeBox &b = nodes[n];
+        node_range(e.lo[0], e.hi[0], dx, win_i0, win_i1, b.i0, b.i1);
+        node_range(e.lo[1], e.hi[1], dy, win_j0, win_j1, b.j0, b.j1);
+        node_range(e.lo[2], e.hi[2], dz, win_k0, win_k1, b.k0, b.k1);
+    }
+
+    parallel_for(win_i0, win_i1 + 1, [&](int first, int last)
+    {
+        std::vector<double> crossings;
+        std::vector<size_t> slab;
+        for (size_t n = 0; n < electrodes.size(); ++n)
+        {
+            const NodeBox &b = nodes[n];
+            if (electrodes[n].kind != Electrode::None && b.i0 < last && b.i1 >= first &&
+                b.j0 <= b.j1 && b.k0 <= b.k1)
+                slab.push_back(n);
+        }
+
+        for (int i = first; i < last; ++i)
+        {
+            double x = i * dx;
+            for (int j = win_j0; j <= win_j1; ++j)
+            {
+                double y = j * dy;
+                for (size_t n : slab)
+                {
+                    const NodeBox &b = nodes[n];
+                    if (i < b.i0 || i > b.i1 || j < b.j0 || j > b.j1)
+                        continue;
+
+                    const Electrode &e = electrodes[n];
+                    if (e.kind == Electrode::Mesh)
+                    {
+                        // inside between alternate crossings of the column with the surface
+                        e.mesh->columnCrossings(x, y, crossings);
+                        for (size_t c = 0; c + 1 < crossings.size(); c += 2)
+                        {
+                            int k0, k1;
+                            node_range(crossings[c], crossings[c + 1], dz, b.k0, b.k1, k0, k1);
+                            for (int k = k0; k <= k1; ++k)
+                            {
+                                double z = k * dz;
+                                if (z >= crossings[c] && z <= crossings[c + 1])
+                                    markElectrode(index(i, j, k), e.potential, e.label);
+                            }
+                        }
+                        continue;
+                    }
+
+                    double z_lo, z_hi;
+                    if (!e.zRange(x, y, z_lo, z_hi))
+                        continue;
+                    int k0, k1;
+                    node_range(z_lo, z_hi, dz, b.k0, b.k1, k0, k1);
+
+                    if (e.transformed)
+                    {
+                        // along the column the local coordinates move by a fixed step per node
+                        const auto &m = e.to_local;
+                        double bx = m[0] * x + m[1] * y + m[3], sx = m[2] * dz;
+                        double by = m[4] * x + m[5] * y + m[7], sy = m[6] * dz;
+                        double bz = m[8] * x + m[9] * y + m[11], sz = m[10] * dz;
+                        for (int k = k0; k <= k1; ++k)
+                        {
+                            if (e.containsLocal(bx + k * sx, by + k * sy, bz + k * sz))
+                                markElectrode(index(i, j, k), e.potential, e.label);
+                        }
+                        continue;
+                    }
+
+                    for (int k = k0; k <= k1; ++k)
+                    {
+                        if (e.contains(x, y, k * dz))
+                            markElectrode(index(i, j, k), e.potential, e.label);
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Cut-cell stencils for every free interior cell with an electrode neighbour. The arm to fixed
+// neighbour nb ends on the surface after arm_fraction(idx, nb) of a cell; the two boundary
+// treatments only differ in how they place it.
+template <class ArmFraction>
+void SimulationBox3D::assembleCutCells(ArmFraction arm_fraction)
+{
+    const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    cut_cells.clear();
+    for (int i = 0; i < nx; ++i)
+        for (int j = 0; j < ny; ++j)
+            for (int k = 0; k < nz; ++k)
+            {
+                int idx = index(i, j, k);
+                if (fixed_mask[idx])
+                    continue;
+
+                // outer faces keep their reduced stencils, only full 6-neighbour cells are cut
+                std::array<int, 6> neighbour;
+                std::array<double, 6> theta;
+                bool interior = true, cut = false;
+                for (int n = 0; n < 6 && interior; ++n)
+                {
+                    int ii = i + offsets[n][0], jj = j + offsets[n][1], kk = k + offsets[n][2];
+                    interior = neighbourCell(ii, jj, kk);
+                    if (!interior)
+                        break;
+                    neighbour[n] = index(ii, jj, kk);
+                    theta[n] = 1.0;
+                    if (fixed_mask[neighbour[n]])
+                    {
+                        theta[n] = arm_fraction(idx, neighbour[n]);
+                        cut = true;
+                    }
+                }
+                if (!interior || !cut)
+                    continue;
+
+                // per axis u'' ~ 2/(tl+tr) ((u_r - u)/tr - (u - u_l)/tl), spacings in units of the cell size
+                CutCell cell{idx, neighbour, {}, 0.0, 0.0};
+                double diag = 0.0;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    double tl = theta[2 * axis], tr = theta[2 * axis + 1];
+                    cell.weight[2 * axis] = 2.0 / (tl * (tl + tr));
+                    cell.weight[2 * axis + 1] = 2.0 / (tr * (tl + tr));
+                    diag += 2.0 / (tl * tr);
+                }
+                for (int n = 0; n < 6; ++n)
+                {
+                    if (!fixed_mask[neighbour[n]])
+                        continue;
+                    cell.boundary += cell.weight[n] * potential[neighbour[n]];
+                    cell.surface[n] = neighbour[n];
+                    cell.neighbour[n] = -1;
+                }
+                cell.inv_diag = 1.0 / diag;
+                cut_cells.push_back(cell);
+            }
+}
+
+inline void SimulationBox3D::buildCutCells()
+{
+    // Distances are only evaluated in the band of cells that have a neighbour on the other side of
+    // the staircase surface (mesh distances are BVH queries); all other cells keep +-unbounded
+    const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    signed_distance.assign(potential.size(), unbounded);
+    parallel_for(0, nx, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+            for (int j = 0; j < ny; ++j)
+                for (int k = 0; k < nz; ++k)
+                {
+                    int idx = index(i, j, k);
+                    bool band = false;
+                    for (int n = 0; n < 6 && !band; ++n)
+                    {
+                        int ii = i + offsets[n][0], jj = j + offsets[n][1], kk = k + offsets[n][2];
+                        band = neighbourCell(ii, jj, kk) && fixed_mask[index(ii, jj, kk)] != fixed_mask[idx];
+                    }
+                    if (!band)
+                    {
+                        signed_distance[idx] = fixed_mask[idx] ? -unbounded : unbounded;
+                        continue;
+                    }
+
+                    double distance = unbounded;
+                    for (const Electrode &e : shapes)
+                        distance = std::min(distance, e.signedDistance(i * dx, j * dy, k * dz));
+                    signed_distance[idx] = distance;
+                }
+    });
+
+    // fraction of the arm from a free cell (distance d_free) to a fixed one (d_fixed) that lies
+    // outside the electrode; clamped so a surface grazing the free cell keeps the stencil finite
+    const double theta_min = 1e-3;
+    auto arm_fraction = [theta_min](double d_free, double d_fixed)
+    {
+        if (d_free <= 0.0)
+            return theta_min;
+        if (d_fixed >= 0.0)
+            return 1.0;
+        return std::clamp(d_free / (d_free - d_fixed), theta_min, 1.0);
+    };
+
+    assembleCutCells([&](int idx, int fixed_idx)
+    {
+        return arm_fraction(signed_distance[idx], signed_distance[fixed_idx]);
+    });
+}
+
+inline void SimulationBox3D::buildPartialVolumes(int samples)
+{
+    samples = std::max(samples, 1);
+    const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    const int total = samples * samples * samples;
+
+    // fractions are only sampled in the band of cells next to the staircase surface (the only
+    // cells it can pass through); all other cells are wholly inside (1) or outside (0)
+    volume_fraction.assign(potential.size(), 0.0);
+    parallel_for(0, nx, [&](int first, int last)
+    {
+        std::vector<const Electrode *> near;
+        for (int i = first; i < last; ++i)
+            for (int j = 0; j < ny; ++j)
+                for (int k = 0; k < nz; ++k)
+                {
+                    int idx = index(i, j, k);
+                    volume_fraction[idx] = fixed_mask[idx] ? 1.0 : 0.0;
+                    bool band = false;
+                    for (int n = 0; n < 6 && !band; ++n)
+                    {
+                        int ii = i + offsets[n][0], jj = j + offsets[n][1], kk = k + offsets[n][2];
+                        band = neighbourCell(ii, jj, kk) && fixed_mask[index(ii, jj, kk)] != fixed_mask[idx];
+                    }
+                    if (!band)
+                        continue;
+
+                    double x = i * dx, y = j * dy, z = k * dz;
+                    near.clear();
+                    for (const Electrode &e : shapes)
+                        if (e.kind != Electrode::None &&
+                            e.lo[0] <= x + 0.5 * dx && e.hi[0] >= x - 0.5 * dx &&
+                            e.lo[1] <= y + 0.5 * dy && e.hi[1] >= y - 0.5 * dy &&
+                            e.lo[2] <= z + 0.5 * dz && e.hi[2] >= z - 0.5 * dz)
+                            near.push_back(&e);
+
+                    int inside = 0;
+                    for (int a = 0; a < samples; ++a)
+                        for (int b = 0; b < samples; ++b)
+                            for (int c = 0; c < samples; ++c)
+                            {
+                                double sx = x + ((a + 0.5) / samples - 0.5) * dx;
+                                double sy = y + ((b + 0.5) / samples - 0.5) * dy;
+                                double sz = z + ((c + 0.5) / samples - 0.5) * dz;
+                                for (const Electrode *e : near)
+                                    if (e->contains(sx, sy, sz))
+                                    {
+                                        ++inside;
+                                        break;
+                                    }
+                            }
+                    volume_fraction[idx] = static_cast<double>(inside) / total;
+                }
+    });
+
+    // Along an arm from a free node (cell fraction f) to a fixed one (fraction g) a flat surface sits
+    // 1/2 - f past the free node if it crosses the free cell, else 1/2 + (1 - g): both are 3/2 - f - g
+    const double theta_min = 1e-3;
+    assembleCutCells([&](int idx, int fixed_idx)
+    {
+        return std::clamp(1.5 - volume_fraction[idx] - volume_fraction[fixed_idx], theta_min, 1.0);
+    });
+}
+
+inline void SimulationBox3D::relaxCutCells()
+{
+    double source_scale = (dx * dx + dy * dy + dz * dz) / (3.0 * eps0);
+    for (const CutCell &cell : cut_cells)
+    {
+        double sum = cell.boundary;
+        for (int n = 0; n < 6; ++n)
+            if (cell.neighbour[n] >= 0)
+                sum += cell.weight[n] * potential[cell.neighbour[n]];
+        if (!charge_density.empty())
+            sum += charge_density[cell.idx] * source_scale;
+        potential[cell.idx] = sum * cell.inv_diag;
+    }
+}
+
+inline void SimulationBox3D::addElectrode(Electrode electrode)
+{
+    electrode.label = current_label;
+    rasterize({electrode});
+}
+
+inline void SimulationBox3D::addSphere(double cx, double cy, double cz, double radius, double potential_value)
+{
+    addElectrode(Electrode::sphere(cx, cy, cz, radius, potential_value));
+}
+
+inline void SimulationBox3D::addBox(double x0, double y0, double z0,
+                             double x1, double y1, double z1, double potential_value)
+{
+    addElectrode(Electrode::box(x0, y0, z0, x1, y1, z1, potential_value));
+}
+
+inline void SimulationBox3D::addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value)
+{
+    addElectrode(Electrode::cylinder(cx, cy, cz, radius, height, axis, potential_value));
+}
+
+inline void SimulationBox3D::addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value)
+{
+    addElectrode(Electrode::hollowPipe(cx, cy, cz, radius, thickness, height, axis, potential_value));
+}
+
+inline void SimulationBox3D::addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value)
+{
+    addElectrode(Electrode::ellipsoid(cx, cy, cz, rx, ry, rz, potential_value));
+}
+
+inline void SimulationBox3D::addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value)
+{
+    addElectrode(Electrode::hyperboloid(cx, cy, cz, a, b, c, waist, axis, potential_value));
+}
+
+inline void SimulationBox3D::addPlane(double A, double B, double C, double D, double thickness, double potential_value)
+{
+    addElectrode(Electrode::plane(A, B, C, D, thickness, potential_value));
+}
+
+inline void SimulationBox3D::applyJacobi()
+{
+    std::vector<double> plane_values = mirrorFaceValues();
+
+    if (brick_storage)
+        applyJacobi(brick_layout);
+    else
+        applyJacobi(RowMajorLayout(nx, ny, nz));
+
+    if (mirror_x || mirror_y)
+        relaxMirrorFaces(plane_values);
+}
+
+inline void SimulationBox3D::applyGaussSeidel()
+{
+    std::vector<double> plane_values = mirrorFaceValues();
+
+    if (brick_storage)
+        applyGaussSeidel(brick_layout);
+    else
+        applyGaussSeidel(RowMajorLayout(nx, ny, nz));
+
+    if (mirror_x || mirror_y)
+        relaxMirrorFaces(plane_values);
+}
+
+template <class Layout>
+void SimulationBox3D::applyJacobi(const Layout &L)
+{
+    std::vector<double> new_potential = potential;
+
+    // Poisson source: rho * h^2 / eps0 with h^2 the mean squared spacing of the 6-point stencil
+    const double *rho = charge_density.empty() ? nullptr : charge_density.data();
+    double source_scale = (dx * dx + dy * dy + dz * dz) / (3.0 * eps0);
+    // boundary nodes average fewer neighbours; scaling by count/6 keeps the interior's rho * h^2 / (6 eps0) per update
+    auto boundary_source = [&](int idx, int count) { return rho ? rho[idx] * source_scale * count / 6.0 : 0.0; };
+
+    // Interior points
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            for (int k = 1; k < nz - 1; ++k)
+            {
+                int idx = L.index(i, j, k);
+                if (!fixed_mask[idx])
+                {
+                    double source = rho ? rho[idx] * source_scale : 0.0;
+                    new_potential[idx] = (1.0 / 6.0) * (potential[L.index(i + 1, j, k)] + potential[L.index(i - 1, j, k)] +
+                                                        potential[L.index(i, j + 1, k)] + potential[L.index(i, j - 1, k)] +
+                                                        potential[L.index(i, j, k + 1)] + potential[L.index(i, j, k - 1)] + source);
+                }
+            }
+        }
+    }
+
+    // Face points
+    for (int j = 1; j < ny - 1; ++j)
+    {
+        for (int k = 1; k < nz - 1; ++k)
+        {
+            int idx = L.index(0, j, k);
+            if (!fixed_mask[idx])
+                new_potential[idx] = (1.0 / 5.0) * (potential[L.index(1, j, k)] + potential[L.index(0, j + 1, k)] +
+                                                    potential[L.index(0, j - 1, k)] + potential[L.index(0, j, k + 1)] +
+                                                    potential[L.index(0, j, k - 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(nx - 1, j, k);
+            if (!fixed_mask[idx1])
+                new_potential[idx1] = (1.0 / 5.0) * (potential[L.index(nx - 2, j, k)] + potential[L.index(nx - 1, j + 1, k)] +
+                                                     potential[L.index(nx - 1, j - 1, k)] + potential[L.index(nx - 1, j, k + 1)] +
+                                                     potential[L.index(nx - 1, j, k - 1)] + boundary_source(idx1, 5));
+        }
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int k = 1; k < nz - 1; ++k)
+        {
+            int idx = L.index(i, 0, k);
+            if (!fixed_mask[idx])
+                new_potential[idx] = (1.0 / 5.0) * (potential[L.index(i + 1, 0, k)] + potential[L.index(i - 1, 0, k)] +
+                                                    potential[L.index(i, 1, k)] + potential[L.index(i, 0, k + 1)] +
+                                                    potential[L.index(i, 0, k - 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(i, ny - 1, k);
+            if (!fixed_mask[idx1])
+                new_potential[idx1] = (1.0 / 5.0) * (potential[L.index(i + 1, ny - 1, k)] + potential[L.index(i - 1, ny - 1, k)] +
+                                                     potential[L.index(i, ny - 2, k)] + potential[L.index(i, ny - 1, k + 1)] +
+                                                     potential[L.index(i, ny - 1, k - 1)] + boundary_source(idx1, 5));
+        }
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            int idx = L.index(i, j, 0);
+            if (!fixed_mask[idx])
+                new_potential[idx] = (1.0 / 5.0) * (potential[L.index(i + 1, j, 0)] + potential[L.index(i - 1, j, 0)] +
+                                                    potential[L.index(i, j + 1, 0)] + potential[L.index(i, j - 1, 0)] +
+                                                    potential[L.index(i, j, 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(i, j, nz - 1);
+            if (!fixed_mask[idx1])
+                new_potential[idx1] = (1.0 / 5.0) * (potential[L.index(i + 1, j, nz - 1)] + potential[L.index(i - 1, j, nz - 1)] +
+                                                     potential[L.index(i, j + 1, nz - 1)] + potential[L.index(i, j - 1, nz - 1)] +
+                                                     potential[L.index(i, j, nz - 2)] + boundary_source(idx1, 5));
+        }
+    }
+
+    // Edge points (4 neighbors)
+    for (int k = 1; k < nz - 1; ++k)
+    {
+        int idx = L.index(0, 0, k);
+        if (!fixed_mask[idx])
+            new_potential[idx] = (1.0 / 4.0) * (potential[L.index(1, 0, k)] + potential[L.index(0, 1, k)] +
+                                                potential[L.index(0, 0, k + 1)] + potential[L.index(0, 0, k - 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(0, ny - 1, k);
+        if (!fixed_mask[idx1])
+            new_potential[idx1] = (1.0 / 4.0) * (potential[L.index(1, ny - 1, k)] + potential[L.index(0, ny - 2, k)] +
+                                                 potential[L.index(0, ny - 1, k + 1)] + potential[L.index(0, ny - 1, k - 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(nx - 1, 0, k);
+        if (!fixed_mask[idx2])
+            new_potential[idx2] = (1.0 / 4.0) * (potential[L.index(nx - 2, 0, k)] + potential[L.index(nx - 1, 1, k)] +
+                                                 potential[L.index(nx - 1, 0, k + 1)] + potential[L.index(nx - 1, 0, k - 1)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(nx - 1, ny - 1, k);
+        if (!fixed_mask[idx3])
+            new_potential[idx3] = (1.0 / 4.0) * (potential[L.index(nx - 2, ny - 1, k)] + potential[L.index(nx - 1, ny - 2, k)] +
+                                                 potential[L.index(nx - 1, ny - 1, k + 1)] + potential[L.index(nx - 1, ny - 1, k - 1)] + boundary_source(idx3, 4));
+    }
+
+    for (int j = 1; j < ny - 1; ++j)
+    {
+        int idx = L.index(0, j, 0);
+        if (!fixed_mask[idx])
+            new_potential[idx] = (1.0 / 4.0) * (potential[L.index(1, j, 0)] + potential[L.index(0, j + 1, 0)] +
+                                                potential[L.index(0, j - 1, 0)] + potential[L.index(0, j, 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(nx - 1, j, 0);
+        if (!fixed_mask[idx1])
+            new_potential[idx1] = (1.0 / 4.0) * (potential[L.index(nx - 2, j, 0)] + potential[L.index(nx - 1, j + 1, 0)] +
+                                                 potential[L.index(nx - 1, j - 1, 0)] + potential[L.index(nx - 1, j, 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(0, j, nz - 1);
+        if (!fixed_mask[idx2])
+            new_potential[idx2] = (1.0 / 4.0) * (potential[L.index(1, j, nz - 1)] + potential[L.index(0, j + 1, nz - 1)] +
+                                                 potential[L.index(0, j - 1, nz - 1)] + potential[L.index(0, j, nz - 2)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(nx - 1, j, nz - 1);
+        if (!fixed_mask[idx3])
+            new_potential[idx3] = (1.0 / 4.0) * (potential[L.index(nx - 2, j, nz - 1)] + potential[L.index(nx - 1, j + 1, nz - 1)] +
+                                                 potential[L.index(nx - 1, j - 1, nz - 1)] + potential[L.index(nx - 1, j, nz - 2)] + boundary_source(idx3, 4));
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        int idx = L.index(i, 0, 0);
+        if (!fixed_mask[idx])
+            new_potential[idx] = (1.0 / 4.0) * (potential[L.index(i + 1, 0, 0)] + potential[L.index(i - 1, 0, 0)] +
+                                                potential[L.index(i, 1, 0)] + potential[L.index(i, 0, 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(i, ny - 1, 0);
+        if (!fixed_mask[idx1])
+            new_potential[idx1] = (1.0 / 4.0) * (potential[L.index(i + 1, ny - 1, 0)] + potential[L.index(i - 1, ny - 1, 0)] +
+                                                 potential[L.index(i, ny - 2, 0)] + potential[L.index(i, ny - 1, 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(i, 0, nz - 1);
+        if (!fixed_mask[idx2])
+            new_potential[idx2] = (1.0 / 4.0) * (potential[L.index(i + 1, 0, nz - 1)] + potential[L.index(i - 1, 0, nz - 1)] +
+                                                 potential[L.index(i, 1, nz - 1)] + potential[L.index(i, 0, nz - 2)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(i, ny - 1, nz - 1);
+        if (!fixed_mask[idx3])
+            new_potential[idx3] = (1.0 / 4.0) * (potential[L.index(i + 1, ny - 1, nz - 1)] + potential[L.index(i - 1, ny - 1, nz - 1)] +
+                                                 potential[L.index(i, ny - 2, nz - 1)] + potential[L.index(i, ny - 1, nz - 2)] + boundary_source(idx3, 4));
+    }
+
+    // Corner points (3 neighbors)
+    if (!fixed_mask[L.index(0, 0, 0)])
+        new_potential[L.index(0, 0, 0)] = (1.0 / 3.0) * (potential[L.index(1, 0, 0)] + potential[L.index(0, 1, 0)] + potential[L.index(0, 0, 1)] + boundary_source(L.index(0, 0, 0), 3));
+
+    if (!fixed_mask[L.index(nx - 1, 0, 0)])
+        new_potential[L.index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[L.index(nx - 2, 0, 0)] + potential[L.index(nx - 1, 1, 0)] + potential[L.index(nx - 1, 0, 1)] + boundary_source(L.index(nx - 1, 0, 0), 3));
+
+    if (!fixed_mask[L.index(0, ny - 1, 0)])
+        new_potential[L.index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[L.index(1, ny - 1, 0)] + potential[L.index(0, ny - 2, 0)] + potential[L.index(0, ny - 1, 1)] + boundary_source(L.index(0, ny - 1, 0), 3));
+
+    if (!fixed_mask[L.index(nx - 1, ny - 1, 0)])
+        new_potential[L.index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[L.index(nx - 2, ny - 1, 0)] + potential[L.index(nx - 1, ny - 2, 0)] + potential[L.index(nx - 1, ny - 1, 1)] + boundary_source(L.index(nx - 1, ny - 1, 0), 3));
+
+    if (!fixed_mask[L.index(0, 0, nz - 1)])
+        new_potential[L.index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[L.index(1, 0, nz - 1)] + potential[L.index(0, 1, nz - 1)] + potential[L.index(0, 0, nz - 2)] + boundary_source(L.index(0, 0, nz - 1), 3));
+
+    if (!fixed_mask[L.index(nx - 1, 0, nz - 1)])
+        new_potential[L.index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[L.index(nx - 2, 0, nz - 1)] + potential[L.index(nx - 1, 1, nz - 1)] + potential[L.index(nx - 1, 0, nz - 2)] + boundary_source(L.index(nx - 1, 0, nz - 1), 3));
+
+    if (!fixed_mask[L.index(0, ny - 1, nz - 1)])
+        new_potential[L.index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[L.index(1, ny - 1, nz - 1)] + potential[L.index(0, ny - 2, nz - 1)] + potential[L.index(0, ny - 1, nz - 2)] + boundary_source(L.index(0, ny - 1, nz - 1), 3));
+
+    if (!fixed_mask[L.index(nx - 1, ny - 1, nz - 1)])
+        new_potential[L.index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[L.index(nx - 2, ny - 1, nz - 1)] + potential[L.index(nx - 1, ny - 2, nz - 1)] + potential[L.index(nx - 1, ny - 1, nz - 2)] + boundary_source(L.index(nx - 1, ny - 1, nz - 1), 3));
+
+    // Final update
+    potential = std::move(new_potential);
+}
+
+template <class Layout>
+void SimulationBox3D::applyGaussSeidel(const Layout &L)
+{
+    const double *rho = charge_density.empty() ? nullptr : charge_density.data();
+    double source_scale = (dx * dx + dy * dy + dz * dz) / (3.0 * eps0);
+    // boundary nodes average fewer neighbours; scaling by count/6 keeps the interior's rho * h^2 / (6 eps0) per update
+    auto boundary_source = [&](int idx, int count) { return rho ? rho[idx] * source_scale * count / 6.0 : 0.0; };
+
+    // Interior points
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            for (int k = 1; k < nz - 1; ++k)
+            {
+                int idx = L.index(i, j, k);
+                if (!fixed_mask[idx])
+                {
+                    double source = rho ? rho[idx] * source_scale : 0.0;
+                    potential[idx] = (1.0 / 6.0) * (potential[L.index(i + 1, j, k)] + potential[L.index(i - 1, j, k)] +
+                                                    potential[L.index(i, j + 1, k)] + potential[L.index(i, j - 1, k)] +
+                                                    potential[L.index(i, j, k + 1)] + potential[L.index(i, j, k - 1)] + source);
+                }
+            }
+        }
+    }
+
+    // Face points (excluding edges and corners)
+    for (int j = 1; j < ny - 1; ++j)
+    {
+        for (int k = 1; k < nz - 1; ++k)
+        {
+            int idx = L.index(0, j, k);
+            if (!fixed_mask[idx])
+                potential[idx] = (1.0 / 5.0) * (potential[L.index(1, j, k)] + potential[L.index(0, j + 1, k)] +
+                                                potential[L.index(0, j - 1, k)] + potential[L.index(0, j, k + 1)] +
+                                                potential[L.index(0, j, k - 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(nx - 1, j, k);
+            if (!fixed_mask[idx1])
+                potential[idx1] = (1.0 / 5.0) * (potential[L.index(nx - 2, j, k)] + potential[L.index(nx - 1, j + 1, k)] +
+                                                 potential[L.index(nx - 1, j - 1, k)] + potential[L.index(nx - 1, j, k + 1)] +
+                                                 potential[L.index(nx - 1, j, k - 1)] + boundary_source(idx1, 5));
+        }
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int k = 1; k < nz - 1; ++k)
+        {
+            int idx = L.index(i, 0, k);
+            if (!fixed_mask[idx])
+                potential[idx] = (1.0 / 5.0) * (potential[L.index(i + 1, 0, k)] + potential[L.index(i - 1, 0, k)] +
+                                                potential[L.index(i, 1, k)] + potential[L.index(i, 0, k + 1)] +
+                                                potential[L.index(i, 0, k - 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(i, ny - 1, k);
+            if (!fixed_mask[idx1])
+                potential[idx1] = (1.0 / 5.0) * (potential[L.index(i + 1, ny - 1, k)] + potential[L.index(i - 1, ny - 1, k)] +
+                                                 potential[L.index(i, ny - 2, k)] + potential[L.index(i, ny - 1, k + 1)] +
+                                                 potential[L.index(i, ny - 1, k - 1)] + boundary_source(idx1, 5));
+        }
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        for (int j = 1; j < ny - 1; ++j)
+        {
+            int idx = L.index(i, j, 0);
+            if (!fixed_mask[idx])
+                potential[idx] = (1.0 / 5.0) * (potential[L.index(i + 1, j, 0)] + potential[L.index(i - 1, j, 0)] +
+                                                potential[L.index(i, j + 1, 0)] + potential[L.index(i, j - 1, 0)] +
+                                                potential[L.index(i, j, 1)] + boundary_source(idx, 5));
+
+            int idx1 = L.index(i, j, nz - 1);
+            if (!fixed_mask[idx1])
+                potential[idx1] = (1.0 / 5.0) * (potential[L.index(i + 1, j, nz - 1)] + potential[L.index(i - 1, j, nz - 1)] +
+                                                 potential[L.index(i, j + 1, nz - 1)] + potential[L.index(i, j - 1, nz - 1)] +
+                                                 potential[L.index(i, j, nz - 2)] + boundary_source(idx1, 5));
+        }
+    }
+
+    // Edge points (4 neighbors)
+    for (int k = 1; k < nz - 1; ++k)
+    {
+        // x edges at y=0 and y=ny-1
+        int idx = L.index(0, 0, k);
+        if (!fixed_mask[idx])
+            potential[idx] = (1.0 / 4.0) * (potential[L.index(1, 0, k)] + potential[L.index(0, 1, k)] +
+                                            potential[L.index(0, 0, k + 1)] + potential[L.index(0, 0, k - 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(0, ny - 1, k);
+        if (!fixed_mask[idx1])
+            potential[idx1] = (1.0 / 4.0) * (potential[L.index(1, ny - 1, k)] + potential[L.index(0, ny - 2, k)] +
+                                             potential[L.index(0, ny - 1, k + 1)] + potential[L.index(0, ny - 1, k - 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(nx - 1, 0, k);
+        if (!fixed_mask[idx2])
+            potential[idx2] = (1.0 / 4.0) * (potential[L.index(nx - 2, 0, k)] + potential[L.index(nx - 1, 1, k)] +
+                                             potential[L.index(nx - 1, 0, k + 1)] + potential[L.index(nx - 1, 0, k - 1)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(nx - 1, ny - 1, k);
+        if (!fixed_mask[idx3])
+            potential[idx3] = (1.0 / 4.0) * (potential[L.index(nx - 2, ny - 1, k)] + potential[L.index(nx - 1, ny - 2, k)] +
+                                             potential[L.index(nx - 1, ny - 1, k + 1)] + potential[L.index(nx - 1, ny - 1, k - 1)] + boundary_source(idx3, 4));
+    }
+
+    for (int j = 1; j < ny - 1; ++j)
+    {
+        int idx = L.index(0, j, 0);
+        if (!fixed_mask[idx])
+            potential[idx] = (1.0 / 4.0) * (potential[L.index(1, j, 0)] + potential[L.index(0, j + 1, 0)] +
+                                            potential[L.index(0, j - 1, 0)] + potential[L.index(0, j, 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(nx - 1, j, 0);
+        if (!fixed_mask[idx1])
+            potential[idx1] = (1.0 / 4.0) * (potential[L.index(nx - 2, j, 0)] + potential[L.index(nx - 1, j + 1, 0)] +
+                                             potential[L.index(nx - 1, j - 1, 0)] + potential[L.index(nx - 1, j, 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(0, j, nz - 1);
+        if (!fixed_mask[idx2])
+            potential[idx2] = (1.0 / 4.0) * (potential[L.index(1, j, nz - 1)] + potential[L.index(0, j + 1, nz - 1)] +
+                                             potential[L.index(0, j - 1, nz - 1)] + potential[L.index(0, j, nz - 2)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(nx - 1, j, nz - 1);
+        if (!fixed_mask[idx3])
+            potential[idx3] = (1.0 / 4.0) * (potential[L.index(nx - 2, j, nz - 1)] + potential[L.index(nx - 1, j + 1, nz - 1)] +
+                                             potential[L.index(nx - 1, j - 1, nz - 1)] + potential[L.index(nx - 1, j, nz - 2)] + boundary_source(idx3, 4));
+    }
+
+    for (int i = 1; i < nx - 1; ++i)
+    {
+        int idx = L.index(i, 0, 0);
+        if (!fixed_mask[idx])
+            potential[idx] = (1.0 / 4.0) * (potential[L.index(i + 1, 0, 0)] + potential[L.index(i - 1, 0, 0)] +
+                                            potential[L.index(i, 1, 0)] + potential[L.index(i, 0, 1)] + boundary_source(idx, 4));
+
+        int idx1 = L.index(i, ny - 1, 0);
+        if (!fixed_mask[idx1])
+            potential[idx1] = (1.0 / 4.0) * (potential[L.index(i + 1, ny - 1, 0)] + potential[L.index(i - 1, ny - 1, 0)] +
+                                             potential[L.index(i, ny - 2, 0)] + potential[L.index(i, ny - 1, 1)] + boundary_source(idx1, 4));
+
+        int idx2 = L.index(i, 0, nz - 1);
+        if (!fixed_mask[idx2])
+            potential[idx2] = (1.0 / 4.0) * (potential[L.index(i + 1, 0, nz - 1)] + potential[L.index(i - 1, 0, nz - 1)] +
+                                             potential[L.index(i, 1, nz - 1)] + potential[L.index(i, 0, nz - 2)] + boundary_source(idx2, 4));
+
+        int idx3 = L.index(i, ny - 1, nz - 1);
+        if (!fixed_mask[idx3])
+            potential[idx3] = (1.0 / 4.0) * (potential[L.index(i + 1, ny - 1, nz - 1)] + potential[L.index(i - 1, ny - 1, nz - 1)] +
+                                             potential[L.index(i, ny - 2, nz - 1)] + potential[L.index(i, ny - 1, nz - 2)] + boundary_source(idx3, 4));
+    }
+
+    // Corners (3 neighbors)
+    if (!fixed_mask[L.index(0, 0, 0)])
+        potential[L.index(0, 0, 0)] = (1.0 / 3.0) * (potential[L.index(1, 0, 0)] + potential[L.index(0, 1, 0)] + potential[L.index(0, 0, 1)] + boundary_source(L.index(0, 0, 0), 3));
+
+    if (!fixed_mask[L.index(nx - 1, 0, 0)])
+        potential[L.index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[L.index(nx - 2, 0, 0)] + potential[L.index(nx - 1, 1, 0)] + potential[L.index(nx - 1, 0, 1)] + boundary_source(L.index(nx - 1, 0, 0), 3));
+
+    if (!fixed_mask[L.index(0, ny - 1, 0)])
+        potential[L.index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[L.index(1, ny - 1, 0)] + potential[L.index(0, ny - 2, 0)] + potential[L.index(0, ny - 1, 1)] + boundary_source(L.index(0, ny - 1, 0), 3));
+
+    if (!fixed_mask[L.index(nx - 1, ny - 1, 0)])
+        potential[L.index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[L.index(nx - 2, ny - 1, 0)] + potential[L.index(nx - 1, ny - 2, 0)] + potential[L.index(nx - 1, ny - 1, 1)] + boundary_source(L.index(nx - 1, ny - 1, 0), 3));
+
+    if (!fixed_mask[L.index(0, 0, nz - 1)])
+        potential[L.index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[L.index(1, 0, nz - 1)] + potential[L.index(0, 1, nz - 1)] + potential[L.index(0, 0, nz - 2)] + boundary_source(L.index(0, 0, nz - 1), 3));
+
+    if (!fixed_mask[L.index(nx - 1, 0, nz - 1)])
+        potential[L.index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[L.index(nx - 2, 0, nz - 1)] + potential[L.index(nx - 1, 1, nz - 1)] + potential[L.index(nx - 1, 0, nz - 2)] + boundary_source(L.index(nx - 1, 0, nz - 1), 3));
+
+    if (!fixed_mask[L.index(0, ny - 1, nz - 1)])
+        potential[L.index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[L.index(1, ny - 1, nz - 1)] + potential[L.index(0, ny - 2, nz - 1)] + potential[L.index(0, ny - 1, nz - 2)] + boundary_source(L.index(0, ny - 1, nz - 1), 3));
+
+    if (!fixed_mask[L.index(nx - 1, ny - 1, nz - 1)])
+        potential[L.index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[L.index(nx - 2, ny - 1, nz - 1)] + potential[L.index(nx - 1, ny - 2, nz - 1)] + potential[L.index(nx - 1, ny - 1, nz - 2)] + boundary_source(L.index(nx - 1, ny - 1, nz - 1), 3));
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        ELECTRODE CONFIG HELPERS
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+inline Electrode electrode_from_json(const json &electrode, int label);
+
+// Optional placement of any electrode entry: "euler": [ax, ay, az] in degrees (about x, then y,
+// then z) or "quaternion": [w, x, y, z], turning about "pivot" (cm, default origin), followed by
+// "translation" (cm)
+inline void place_from_json(const json &electrode, Electrode &shape)
+{
+    bool has_euler = electrode.contains("euler") && electrode["euler"].is_array() && electrode["euler"].size() == 3;
+    bool has_quaternion = electrode.contains("quaternion") && electrode["quaternion"].is_array() && electrode["quaternion"].size() == 4;
+    bool has_translation = electrode.contains("translation") && electrode["translation"].is_array() && electrode["translation"].size() == 3;
+    if (!has_euler && !has_quaternion && !has_translation)
+        return;
+
+    std::array<double, 9> R = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    if (has_quaternion)
+    {
+        double w = electrode["quaternion"][0], x = electrode["quaternion"][1], y = electrode["quaternion"][2], z = electrode["quaternion"][3];
+        double norm = std::sqrt(w * w + x * x + y * y + z * z);
+        if (norm == 0.0)
+            throw std::runtime_error("Zero quaternion in electrode placement");
+        w /= norm;
+        x /= norm;
+        y /= norm;
+        z /= norm;
+        R = {1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y),
+             2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x),
+             2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y)};
+    }
+    else if (has_euler)
+    {
+        double deg = pi / 180.0;
+        double a = electrode["euler"][0].get<double>() * deg, b = electrode["euler"][1].get<double>() * deg, g = electrode["euler"][2].get<double>() * deg;
+        double ca = std::cos(a), sa = std::sin(a), cb = std::cos(b), sb = std::sin(b), cg = std::cos(g), sg = std::sin(g);
+        // Rz(g) Ry(b) Rx(a)
+        R = {cg * cb, cg * sb * sa - sg * ca, cg * sb * ca + sg * sa,
+             sg * cb, sg * sb * sa + cg * ca, sg * sb * ca - cg * sa,
+             -sb, cb * sa, cb * ca};
+    }
+
+    std::array<double, 3> pivot = {0, 0, 0}, translation = {0, 0, 0};
+    if (electrode.contains("pivot") && electrode["pivot"].is_array() && electrode["pivot"].size() == 3)
+        for (int d = 0; d < 3; ++d)
+            pivot[d] = electrode["pivot"][d].get<double>() * cm;
+    if (has_translation)
+        for (int d = 0; d < 3; ++d)
+            translation[d] = electrode["translation"][d].get<double>() * cm;
+
+    // world = R (local - pivot) + pivot + translation
+    std::array<double, 3> shift;
+    for (int d = 0; d < 3; ++d)
+        shift[d] = pivot[d] + translation[d] - (R[3 * d] * pivot[0] + R[3 * d + 1] * pivot[1] + R[3 * d + 2] * pivot[2]);
+    shape.place(R, shift);
+}
+
+// Appends the subtree of one CSG node (or a plain electrode as a leaf) to the program and
+// returns its bounding box through the instruction. False on an unknown operation. Leaves and
+// the top node can be placed (see place_from_json), nested CSG nodes cannot.
+inline bool compile_csg(const json &node, CsgProgram &program)
+{
+    using Instruction = CsgProgram::Instruction;
+    int pc = static_cast<int>(program.code.size());
+    program.code.push_back({Instruction::Leaf, pc + 1, -1, {}, {}});
+
+    if (node.value("type", "") != "CSG")
+    {
+        Electrode leaf = electrode_from_json(node, 0);
+        if (leaf.kind == Electrode::None)
+        {
+            leaf.lo = {unbounded, unbounded, unbounded};
+            leaf.hi = {-unbounded, -unbounded, -unbounded};
+        }
+        program.code[pc].leaf = static_cast<int>(program.leaves.size());
+        program.code[pc].lo = leaf.lo;
+        program.code[pc].hi = leaf.hi;
+        program.leaves.push_back(leaf);
+        return true;
+    }
+
+    std::string op = node.value("op", "union");
+    Instruction::Op code_op;
+    if (op == "union")
+        code_op = Instruction::Union;
+    else if (op == "intersection")
+        code_op = Instruction::Intersection;
+    else if (op == "difference")
+        code_op = Instruction::Difference;
+    else
+    {
+        std::cerr << "  [!] Unknown CSG operation: " << op << "\n";
+        return false;
+    }
+
+    std::array<double, 3> lo = {unbounded, unbounded, unbounded}, hi = {-unbounded, -unbounded, -unbounded};
+    if (code_op == Instruction::Intersection)
+    {
+        lo = {-unbounded, -unbounded, -unbounded};
+        hi = {unbounded, unbounded, unbounded};
+    }
+
+    bool first = true;
+    if (node.contains("children") && node["children"].is_array())
+    {
+        for (const auto &child : node["children"])
+        {
+            int child_pc = static_cast<int>(program.code.size());
+            if (!compile_csg(child, program))
+                return false;
+            const Instruction &c = program.code[child_pc];
+            for (int d = 0; d < 3; ++d)
+            {
+                if (code_op == Instruction::Union)
+                {
+                    lo[d] = std::min(lo[d], c.lo[d]);
+                    hi[d] = std::max(hi[d], c.hi[d]);
+                }
+                else if (code_op == Instruction::Intersection)
+                {
+                    lo[d] = std::max(lo[d], c.lo[d]);
+                    hi[d] = std::min(hi[d], c.hi[d]);
+                }
+                else if (first)
+                {
+                    lo[d] = c.lo[d]; // a difference lies inside its first child
+                    hi[d] = c.hi[d];
+                }
+            }
+            first = false;
+        }
+    }
+    if (first && code_op == Instruction::Intersection)
+    {
+        lo = {unbounded, unbounded, unbounded}; // no children: empty
+        hi = {-unbounded, -unbounded, -unbounded};
+    }
+
+    program.code[pc] = {code_op, static_cast<int>(program.code.size()), -1, lo, hi};
+    return true;
+}
+
+// primitive for one entry of an ElectrodeConfig_*.json file (lengths in cm), tagged with label;
+// unknown types give an Electrode::None that rasterizes nothing
+inline Electrode electrode_from_json(const json &electrode, int label)
+{
+    Electrode result;
+
+    std::string type = "Unknown";
+    if (electrode.contains("type") && electrode["type"].is_string())
+    {
+        type = electrode["type"];
+    }
+
+    if (type == "Plate")
+    {
+        double A = electrode.value("A", 0.0);
+        double B = electrode.value("B", 0.0);
+        double C = electrode.value("C", 0.0);
+        double D = electrode.value("D", 0.0);
+        double thickness = electrode.value("thickness", 0.0);
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::plane(A, B, C, D * cm, thickness * cm, potential_val);
+
+        // cout<<A<<B<<C<<D*cm<<thickness*cm<<potential_val<<endl;
+    }
+
+    else if (type == "Cylinder")
+    {
+        double cx = electrode.value("cx", 0.0);
+        double cy = electrode.value("cy", 0.0);
+        double cz = electrode.value("cz", 0.0);
+        double radius = electrode.value("radius", 0.0);
+        double height = electrode.value("height", 0.0);
+        char axis = 'z';
+        if (electrode.contains("axis") && electrode["axis"].is_string())
+        {
+            std::string axis_str = electrode["axis"];
+            if (!axis_str.empty())
+                axis = axis_str[0];
+        }
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::cylinder(cx*cm, cy*cm, cz*cm, radius*cm, height*cm, axis, potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "HollowRod")
+    {
+        double cx = electrode.value("cx", 0.0);
+        double cy = electrode.value("cy", 0.0);
+        double cz = electrode.value("cz", 0.0);
+        double radius = electrode.value("radius", 0.0);
+        double height = electrode.value("height", 0.0);
+        double thickness = electrode.value("thickness", 0.0);
+        char axis = 'z';
+        if (electrode.contains("axis") && electrode["axis"].is_string())
+        {
+            std::string axis_str = electrode["axis"];
+            if (!axis_str.empty())
+                axis = axis_str[0];
+        }
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::hollowPipe(cx*cm,cy*cm,cz*cm,radius*cm,thickness*cm,height*cm,axis,potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "Box")
+    {
+        double x0 = electrode.value("x0", 0.0);
+        double y0 = electrode.value("y0", 0.0);
+        double z0 = electrode.value("z0", 0.0);
+        double x1 = electrode.value("x1", 0.0);
+        double y1 = electrode.value("y1", 0.0);
+        double z1 = electrode.value("z1", 0.0);
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::box(x0*cm,y0*cm,z0*cm,x1*cm,y1*cm,z1*cm,potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "Spherical")
+    {
+        double cx = electrode.value("cx", 0.0);
+        double cy = electrode.value("cy", 0.0);
+        double cz = electrode.value("cz", 0.0);
+        double radius = electrode.value("radius", 0.0);
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::sphere(cx*cm,cy*cm,cz*cm,radius*cm,potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "Ellipsoidal")
+    {
+        double cx = electrode.value("cx", 0.0);
+        double cy = electrode.value("cy", 0.0);
+        double cz = electrode.value("cz", 0.0);
+        double rx = electrode.value("rx", 0.0);
+        double ry = electrode.value("ry", 0.0);
+        double rz = electrode.value("rz", 0.0);
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::ellipsoid(cx*cm,cy*cm,cz*cm,rx*cm,ry*cm,rz*cm,potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "Hyperboloidal")
+    {
+        double cx = electrode.value("cx", 0.0);
+        double cy = electrode.value("cy", 0.0);
+        double cz = electrode.value("cz", 0.0);
+        double a = electrode.value("a", 0.0);
+        double b = electrode.value("b", 0.0);
+        double c = electrode.value("c", 0.0);
+        double waist = electrode.value("waist", 0.0);
+        char axis = 'z';
+        if (electrode.contains("axis") && electrode["axis"].is_string())
+        {
+            std::string axis_str = electrode["axis"];
+            if (!axis_str.empty())
+                axis = axis_str[0];
+        }
+        double potential_val = electrode.value("potential", 0.0);
+
+        result = Electrode::hyperboloid(cx*cm,cy*cm,cz*cm,a*cm,b*cm,c*cm,waist*cm,axis,potential_val);
+        // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
+    }
+
+    else if (type == "Mesh")
+    {
+        // closed STL (binary or ASCII) or OBJ surface; "scale" converts the file units to cm
+        std::string path = electrode.value("file", "");
+        double scale = electrode.value("scale", 1.0);
+        double potential_val = electrode.value("potential", 0.0);
+
+        try
+        {
+            auto mesh = TriangleMesh::load(path, scale * cm);
+            std::cout << "  Mesh: " << mesh->triangles.size() << " triangles\n";
+            result = Electrode::fromMesh(mesh, potential_val);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "  [!] Could not load mesh: " << e.what() << "\n";
+        }
+    }
+
+    else if (type == "CSG")
+    {
+        // {"op": "union" | "intersection" | "difference", "children": [electrode or CSG node, ...]};
+        // only the potential of the top node counts
+        auto program = std::make_shared<CsgProgram>();
+        if (compile_csg(electrode, *program))
+            result = Electrode::fromCsg(program, electrode.value("potential", 0.0));
+    }
+
+    else
+    {
+        std::cout << "  [!] Unknown electrode type. Skipping parsing.\n";
+    }
+
+    place_from_json(electrode, result);
+    result.label = label;
+    return result;
+}
+
+// primitives of all electrode entries in file order, labelled 1, 2, ...
+inline std::vector<Electrode> electrodes_from_json(const std::vector<std::pair<std::string, json>> &electrodes)
+{
+    std::vector<Electrode> shapes;
+    shapes.reserve(electrodes.size());
+    for (size_t n = 0; n < electrodes.size(); ++n)
+        shapes.push_back(electrode_from_json(electrodes[n].second, static_cast<int>(n) + 1));
+    return shapes;
+}
+
+// Appends every entry of the "electrodes" array in one JSON file. Entries are keyed by the file
+// name, with "[n]" appended from the second entry on.
+inline void read_electrode_file(const fs::path &filepath, std::vector<std::pair<std::string, json>> &electrodes)
+{
+    std::string filename = filepath.filename().string();
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open: " << filename << "\n";
+        return;
+    }
+
+    json j;
+    try
+    {
+        std::ostringstream text;
+        text << file.rdbuf();
+        j = json::parse(text.str());
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "JSON parsing error in " << filename << ": " << e.what() << "\n";
+        return;
+    }
+
+    if (!j.contains("electrodes") || !j["electrodes"].is_array() || j["electrodes"].empty())
+    {
+        std::cerr << "Invalid or missing 'electrodes' in " << filename << "\n";
+        return;
+    }
+
+    std::cout << "\nFile: " << filename << "\n";
+    for (size_t n = 0; n < j["electrodes"].size(); ++n)
+    {
+        const auto &electrode = j["electrodes"][n];
+        std::string type = "Unknown";
+        if (electrode.contains("type") && electrode["type"].is_string())
+        {
+            type = electrode["type"];
+        }
+        std::cout << "Type: " << type << "\n";
+
+        electrodes.push_back({n == 0 ? filename : filename + "[" + std::to_string(n) + "]", electrode});
+    }
+}
+
+// All electrode entries of a run: the consolidated scene file if one is named (one open and one
+// parse for the whole scene), otherwise every ElectrodeConfig_*.json in the working directory
+inline std::vector<std::pair<std::string, json>> load_electrode_entries(const std::string &scene_file)
+{
+    std::vector<std::pair<std::string, json>> electrodes;
+    if (!scene_file.empty())
+    {
+        if (!fs::exists(scene_file))
+            throw std::runtime_error("Scene file not found: " + scene_file);
+        read_electrode_file(scene_file, electrodes);
+        return electrodes;
+    }
+
+    for (const auto &entry : fs::directory_iterator("."))
+    {
+        fs::path filepath = entry.path();
+        std::string filename = filepath.filename().string();
+
+        if (filepath.extension() == ".json" &&
+            filename.rfind("ElectrodeConfig_", 0) == 0)
+        {
+            read_electrode_file(filepath, electrodes);
+        }
+    }
+    return electrodes;
+}
+
+// physical bounding box (m) of one electrode entry. Returns false for the
+// unbounded shapes (plates and hyperboloids), which can touch every cell.
+inline bool electrode_bounds(const json &electrode, std::array<double, 3> &lo, std::array<double, 3> &hi)
+{
+    Electrode shape = electrode_from_json(electrode, 0);
+    if (shape.kind == Electrode::None)
+    {
+        lo = {1e300, 1e300, 1e300}; // unknown types rasterize nothing
+        hi = {-1e300, -1e300, -1e300};
+        return true;
+    }
+    lo = shape.lo;
+    hi = shape.hi;
+    return shape.bounded();
+}
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        GEOMETRY CACHE
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// geometry_cache.bin holds the row-major electrode labels of the last rasterization behind a small
+// header with the grid size and a hash of everything the labels depend on. save_geometry writes it
+// for the preview and the solver maps it instead of rasterizing the same scene a second time.
+const std::string geometry_cache_file = "geometry_cache.bin";
+
+struct GeometryCacheHeader
+{
+    char magic[8];
+    std::uint64_t hash;
+    std::int32_t nx, ny, nz;
+    std::uint32_t version;
+};
+constexpr std::uint32_t geometry_cache_version = 1;
+
+// Read-only view of a whole file through the OS page cache (no copy into a buffer)
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return;
+        bytes = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (bytes)
+            length_bytes = static_cast<size_t>(length.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+            return;
+        void *view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED)
+            return;
+        bytes = static_cast<const unsigned char *>(view);
+        length_bytes = static_cast<size_t>(info.st_size);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char *>(bytes), length_bytes);
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool valid() const { return bytes != nullptr; }
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length_bytes; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    size_t length_bytes = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// 64-bit FNV-1a, continued from h
+inline std::uint64_t fnv1a(const void *data, size_t n, std::uint64_t h = 14695981039346656037ull)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+// Grid description shared by the geometry and incremental caches
+inline json grid_key_json(int nx, int ny, int nz, double lx, double ly, double lz, bool mirror_x, bool mirror_y)
+{
+    return {{"nx", nx}, {"ny", ny}, {"nz", nz}, {"Lx", lx}, {"Ly", ly}, {"Lz", lz},
+            {"mirror_x", mirror_x}, {"mirror_y", mirror_y}};
+}
+
+// Mixes the contents of every mesh file an entry (or any CSG child of it) imports into h
+inline std::uint64_t hash_mesh_files(const json &node, std::uint64_t h = 14695981039346656037ull)
+{
+    if (node.is_object())
+    {
+        if (node.contains("type") && node["type"] == "Mesh" && node.contains("file") && node["file"].is_string())
+        {
+            MappedFile mesh(node["file"].get<std::string>());
+            if (mesh.valid())
+                h = fnv1a(mesh.data(), mesh.size(), h);
+        }
+        for (const auto &item : node.items())
+            h = hash_mesh_files(item.value(), h);
+    }
+    else if (node.is_array())
+    {
+        for (const auto &item : node)
+            h = hash_mesh_files(item, h);
+    }
+    return h;
+}
+
+// Hash of the grid, the electrode entries in order and the meshes they import. The top-level
+// potentials are left out: the labels do not depend on them, so a voltage sweep reuses the cache.
+inline std::uint64_t geometry_hash(const json &grid_key, const std::vector<std::pair<std::string, json>> &electrodes)
+{
+    std::string text = grid_key.dump();
+    std::uint64_t h = fnv1a(text.data(), text.size());
+    for (const auto &entry : electrodes)
+    {
+        json shape = entry.second;
+        if (shape.is_object())
+            shape.erase("potential");
+        text = shape.dump();
+        h = fnv1a(text.data(), text.size(), h);
+        h = hash_mesh_files(entry.second, h);
+    }
+    return h;
+}
+
+inline void save_geometry_cache(const SimulationBox3D &box, std::uint64_t hash)
+{
+    GeometryCacheHeader header = {{'E', 'G', 'E', 'O', 'C', 'A', 'C', 'H'}, hash, box.nx, box.ny, box.nz, geometry_cache_version};
+    std::vector<std::int32_t> label_rm(static_cast<size_t>(box.nx) * box.ny * box.nz);
+    parallel_for(0, box.nx, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+            for (int j = 0; j < box.ny; ++j)
+                for (int k = 0; k < box.nz; ++k)
+                    label_rm[(static_cast<size_t>(i) * box.ny + j) * box.nz + k] = box.label[box.index(i, j, k)];
+    });
+
+    // written next to the cache and renamed over it, so a reader never maps a half-written file
+    std::string partial = geometry_cache_file + ".part";
+    {
+        std::ofstream out(partial, std::ios::binary);
+        if (!out)
+        {
+            std::cerr << "Error: Could not write the geometry cache.\n";
+            return;
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(label_rm.data()), label_rm.size() * sizeof(std::int32_t));
+    }
+    std::error_code ec;
+    fs::rename(partial, geometry_cache_file, ec);
+    if (ec)
+        std::cerr << "Error: Could not write the geometry cache: " << ec.message() << "\n";
+}
+
+// Rebuilds the rasterized electrodes of a fresh box from the cache. Returns false (rasterize
+// needed) if there is no cache or it was made for another grid or scene. The electrode shapes are
+// only rebuilt (meshes loaded, BVHs built) with_shapes, for the boundary treatments and the surface
+// preview; otherwise the potentials are read straight from the entries and box.shapes stays empty.
+inline bool load_geometry_cache(SimulationBox3D &box, const std::vector<std::pair<std::string, json>> &electrodes, std::uint64_t hash,
+                                bool with_shapes = true)
+{
+    if (!fs::exists(geometry_cache_file))
+        return false;
+    MappedFile cache(geometry_cache_file);
+    size_t n = static_cast<size_t>(box.nx) * box.ny * box.nz;
+    if (!cache.valid() || cache.size() != sizeof(GeometryCacheHeader) + n * sizeof(std::int32_t))
+        return false;
+
+    GeometryCacheHeader header;
+    std::memcpy(&header, cache.data(), sizeof(header));
+    if (std::memcmp(header.magic, "EGEOCACH", 8) != 0 || header.version != geometry_cache_version ||
+        header.hash != hash || header.nx != box.nx || header.ny != box.ny || header.nz != box.nz)
+        return false;
+
+    std::vector<Electrode> shapes;
+    std::vector<double> potentials;
+    if (with_shapes)
+        shapes = electrodes_from_json(electrodes);
+    for (size_t n = 0; n < electrodes.size(); ++n)
+        potentials.push_back(with_shapes ? shapes[n].potential
+                                         : electrodes[n].second.is_object() ? electrodes[n].second.value("potential", 0.0) : 0.0);
+    const unsigned char *labels = cache.data() + sizeof(GeometryCacheHeader);
+    parallel_for(0, box.nx, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+            for (int j = 0; j < box.ny; ++j)
+                for (int k = 0; k < box.nz; ++k)
+                {
+                    std::int32_t l;
+                    std::memcpy(&l, labels + ((static_cast<size_t>(i) * box.ny + j) * box.nz + k) * sizeof(l), sizeof(l));
+                    if (l > 0 && static_cast<size_t>(l) <= potentials.size())
+                        box.markElectrode(box.index(i, j, k), potentials[l - 1], l);
+                }
+    });
+    box.shapes.insert(box.shapes.end(), shapes.begin(), shapes.end());
+    std::cout << "Geometry loaded from " << geometry_cache_file << std::endl;
+    return true;
+}
+
+#endif // SIMULATION_BOX_HPP
@@ -9,7 +9,7 @@ The E field is defined by the potentials on several electrodes in the system. He
 B field (Bx, By, Bz) as the global variable. Then in the main funciton we define the simulation box as a 3d box with
 given sides and resolution. The electrodeds can take the shapes like plate (capacitor), sphere, cylinder, hyperboloide,
 ellipsoid, hollow pipe, or rectangular box. And combination of them that gives a valid boundary condition is also allowed.
-Arbitrary shapes are not possible in this scope.
+Arbitrary shapes can be imported as closed triangle meshes (STL or OBJ files, electrode type "Mesh").
 
 The simulator solves the Laplace equation numerically over the grid points and. The test particle (or multiparticles) can
 be injected into the system with initial position and velocity. The function named propagator(particle) uses boris pusher
@@ -28,7 +28,15 @@ to a temporary python __main__ for easier visualization. The python package Maya
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
 #include "json.hpp"
+#include "simulation_box.hpp"
 // #include "C:\\Users\\mrsag\\AppData\\Local\\Programs\\Python\\Python311\\include\\Python.h"
 
 using namespace std;
@@ -38,8 +46,6 @@ namespace fs = std::filesystem;
 
 double Bx, By, Bz;
 
-double cm = 1e-2;
-double mm = 1e-3;
 double qe = 1.60217663e-19;
 double me = 9.10938e-31;
 double mH = 1.67262192e-27;
@@ -51,677 +57,483 @@ double kev_to_joule = 1.660217663e-16;
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-                                3D SIMULATION BOX OBJECT FOR MAIN GEOMETRY
+                                        MAGNETIC FIELD MAP
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 */
 
-class SimulationBox3D
+// Measured or simulated B field on its own regular grid ("B_map" in config.json), added to the uniform
+// (Bx, By, Bz) inside the map and zero outside it. A CSV map (x y z in cm, Bx By Bz in T, one node per
+// line, any order, comma or blank separated) is converted once to a .bin next to it; the .bin is
+// memory-mapped, so even multi-GB maps open instantly and concurrent runs share the same pages.
+//
+// .bin layout: BMapHeader, then Bx By Bz (double) per node, x index slowest and z fastest.
+struct BMapHeader
 {
-public:
-    int nx, ny, nz;
-    double lx, ly, lz;
-    double dx, dy, dz;
-
-    SimulationBox3D(int nx, int ny, int nz,
-                    double lx, double ly, double lz,
-                    double potential_offset = 0.0);
-
-    void addSphere(double cx, double cy, double cz, double radius, double potential_value);
-    void addBox(double x0, double y0, double z0,
-                double x1, double y1, double z1, double potential_value);
-
-    void addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value);
-    void addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value);
-    void addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value);
-    void addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value);
-    void addPlane(double A, double B, double C, double D, double thickness, double potential_value);
-
-    void solve(int max_iter = 1000, double tol = 1e-4, const std::string &method = "jacobi");
-
-    // Add geometry will be added next (e.g., addBox, addSphere)
-
-    const std::vector<double> &getPotential() const { return potential; }
+    char magic[8];           // "BFIELDv1"
+    std::int32_t nx, ny, nz;
+    std::int32_t reserved;
+    double x0, y0, z0;       // first node (m)
+    double dx, dy, dz;       // spacing (m)
+};
 
-    std::vector<double> potential;
-    std::vector<double> geometry;
-    std::vector<bool> fixed_mask;
+class MagneticFieldMap
+{
+public:
+    explicit MagneticFieldMap(const std::string &path)
+        : file(path)
+    {
+        if (!file.valid() || file.size() < sizeof(BMapHeader))
+            throw std::runtime_error("Could not map B field file: " + path);
+        std::memcpy(&header, file.data(), sizeof(header));
+        size_t nodes = static_cast<size_t>(header.nx) * header.ny * header.nz;
+        if (std::memcmp(header.magic, "BFIELDv1", 8) != 0 || header.nx < 2 || header.ny < 2 || header.nz < 2 ||
+            file.size() != sizeof(BMapHeader) + 3 * nodes * sizeof(double))
+            throw std::runtime_error("Not a valid B field map: " + path);
+        values = reinterpret_cast<const double *>(file.data() + sizeof(BMapHeader));
+    }
 
-    int index(int i, int j, int k) const
+    // trilinear B (T) at (x, y, z) in m; false outside the map
+    bool at(double x, double y, double z, double &bx, double &by, double &bz) const
     {
-        return i * ny * nz + j * nz + k;
+        double fx = (x - header.x0) / header.dx, fy = (y - header.y0) / header.dy, fz = (z - header.z0) / header.dz;
+        if (!(fx >= 0.0 && fy >= 0.0 && fz >= 0.0 && fx <= header.nx - 1 && fy <= header.ny - 1 && fz <= header.nz - 1))
+            return false;
+        int i = std::min(static_cast<int>(fx), header.nx - 2);
+        int j = std::min(static_cast<int>(fy), header.ny - 2);
+        int k = std::min(static_cast<int>(fz), header.nz - 2);
+        double tx = fx - i, ty = fy - j, tz = fz - k;
+
+        bx = by = bz = 0.0;
+        for (int c = 0; c < 8; ++c)
+        {
+            int di = c & 1, dj = c >> 1 & 1, dk = c >> 2 & 1;
+            double w = (di ? tx : 1.0 - tx) * (dj ? ty : 1.0 - ty) * (dk ? tz : 1.0 - tz);
+            const double *b = values + 3 * ((static_cast<size_t>(i + di) * header.ny + (j + dj)) * header.nz + (k + dk));
+            bx += w * b[0];
+            by += w * b[1];
+            bz += w * b[2];
+        }
+        return true;
     }
 
-    void applyJacobi();
-    void applyGaussSeidel();
-};
+    const BMapHeader &grid() const { return header; }
 
-SimulationBox3D::SimulationBox3D(int nx, int ny, int nz,
-                                 double lx, double ly, double lz,
-                                 double potential_offset)
-    : nx(nx), ny(ny), nz(nz), lx(lx), ly(ly), lz(lz)
-{
-    dx = lx / (nx - 1);
-    dy = ly / (ny - 1);
-    dz = lz / (nz - 1);
-
-    int total_size = nx * ny * nz;
-    potential.resize(total_size, potential_offset);
-    geometry = potential;
-    fixed_mask.resize(total_size, false);
-}
+private:
+    MappedFile file;
+    BMapHeader header;
+    const double *values = nullptr;
+};
 
-void SimulationBox3D::solve(int max_iter, double tol, const std::string &method)
+// Converts a CSV map to the binary layout above (written next to it and renamed into place)
+void convert_b_map_csv(const std::string &csv_path, const std::string &bin_path)
 {
-    std::vector<double> V_old = potential;
-    std::vector<double> V_new = potential;
+    std::ifstream in(csv_path);
+    if (!in)
+        throw std::runtime_error("Could not open B field map: " + csv_path);
 
-    for (int iter = 0; iter < max_iter; ++iter)
+    std::vector<std::array<double, 6>> rows;
+    std::string line;
+    while (std::getline(in, line))
     {
-        V_old = potential;
-
-        if (method == "jacobi")
-        {
-            applyJacobi();
-        }
-        else if (method == "gauss-seidel")
-        {
-            applyGaussSeidel();
-        }
-        else
-        {
-            throw std::runtime_error("Unknown method");
-        }
-
-        // Check for convergence
-        double max_diff = 0.0;
-        for (size_t i = 0; i < potential.size(); ++i)
-        {
-            max_diff = std::max(max_diff, std::abs(potential[i] - V_old[i]));
-        }
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        std::array<double, 6> row;
+        if (fields >> row[0] >> row[1] >> row[2] >> row[3] >> row[4] >> row[5])
+            rows.push_back(row); // header and comment lines do not parse and are skipped
+    }
+    if (rows.empty())
+        throw std::runtime_error("No nodes in B field map: " + csv_path);
 
-        std::cout << "Iteration " << iter << ", Max Diff = " << max_diff << std::endl;
+    // the distinct coordinates along each axis define the grid
+    std::array<std::vector<double>, 3> axes;
+    for (int a = 0; a < 3; ++a)
+    {
+        for (const auto &row : rows)
+            axes[a].push_back(row[a]);
+        std::sort(axes[a].begin(), axes[a].end());
+        double span = axes[a].back() - axes[a].front();
+        axes[a].erase(std::unique(axes[a].begin(), axes[a].end(),
+                                  [span](double u, double v) { return std::abs(u - v) <= 1e-9 * span; }),
+                      axes[a].end());
+        if (axes[a].size() < 2)
+            throw std::runtime_error("B field map needs at least 2 nodes along every axis: " + csv_path);
+    }
 
-        if (max_diff <= tol)
-        {
-            std::cout << "Converged at iteration " << iter << std::endl;
-            break;
-        }
+    BMapHeader header = {{'B', 'F', 'I', 'E', 'L', 'D', 'v', '1'},
+                         static_cast<std::int32_t>(axes[0].size()), static_cast<std::int32_t>(axes[1].size()),
+                         static_cast<std::int32_t>(axes[2].size()), 0,
+                         axes[0].front() * cm, axes[1].front() * cm, axes[2].front() * cm,
+                         (axes[0].back() - axes[0].front()) / (axes[0].size() - 1) * cm,
+                         (axes[1].back() - axes[1].front()) / (axes[1].size() - 1) * cm,
+                         (axes[2].back() - axes[2].front()) / (axes[2].size() - 1) * cm};
+    size_t nodes = axes[0].size() * axes[1].size() * axes[2].size();
+    if (rows.size() != nodes)
+        throw std::runtime_error("B field map is not a full regular grid: " + csv_path);
+
+    std::vector<double> values(3 * nodes, 0.0);
+    for (const auto &row : rows)
+    {
+        size_t i = std::lround((row[0] * cm - header.x0) / header.dx);
+        size_t j = std::lround((row[1] * cm - header.y0) / header.dy);
+        size_t k = std::lround((row[2] * cm - header.z0) / header.dz);
+        size_t n = (i * header.ny + j) * header.nz + k;
+        values[3 * n] = row[3];
+        values[3 * n + 1] = row[4];
+        values[3 * n + 2] = row[5];
     }
-}
 
-void SimulationBox3D::addSphere(double cx, double cy, double cz, double radius, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
+    std::string partial = bin_path + ".part";
     {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double dist = std::sqrt((x - cx) * (x - cx) +
-                                        (y - cy) * (y - cy) +
-                                        (z - cz) * (z - cz));
-                if (dist <= radius)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
+        std::ofstream out(partial, std::ios::binary);
+        if (!out)
+            throw std::runtime_error("Could not write B field map: " + bin_path);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
     }
+    fs::rename(partial, bin_path);
 }
 
-void SimulationBox3D::addBox(double x0, double y0, double z0,
-                             double x1, double y1, double z1, double potential_value)
+// Opens a .bin map, converting a CSV first unless an up-to-date .bin sits next to it
+std::unique_ptr<MagneticFieldMap> load_b_map(const std::string &path)
 {
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        if (x < x0 || x > x1)
-            continue;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            if (y < y0 || y > y1)
-                continue;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                if (z < z0 || z > z1)
-                    continue;
+    if (fs::path(path).extension() != ".csv")
+        return std::make_unique<MagneticFieldMap>(path);
 
-                int idx = index(i, j, k);
-                potential[idx] = potential_value;
-                geometry[idx] = potential_value;
-                fixed_mask[idx] = true;
-            }
-        }
+    std::string bin_path = fs::path(path).replace_extension(".bin").string();
+    if (!fs::exists(bin_path) || fs::last_write_time(bin_path) < fs::last_write_time(path))
+    {
+        std::cout << "Converting " << path << " to " << bin_path << std::endl;
+        convert_b_map_csv(path, bin_path);
     }
+    return std::make_unique<MagneticFieldMap>(bin_path);
 }
 
-void SimulationBox3D::addCylinder(double cx, double cy, double cz, double radius, double height, char axis, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
+std::unique_ptr<MagneticFieldMap> B_map; // optional, on top of (Bx, By, Bz)
 
-                bool inside = false;
-                if (axis == 'z')
-                {
-                    double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
-                    inside = (r2 <= radius * radius && z >= cz && z <= cz + height);
-                }
-                else if (axis == 'x')
-                {
-                    double r2 = (y - cy) * (y - cy) + (z - cz) * (z - cz);
-                    inside = (r2 <= radius * radius && x >= cx && x <= cx + height);
-                }
-                else if (axis == 'y')
-                {
-                    double r2 = (x - cx) * (x - cx) + (z - cz) * (z - cz);
-                    inside = (r2 <= radius * radius && y >= cy && y <= cy + height);
-                }
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-                if (inside)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
-    }
-}
+                                        ANALYTIC MAGNET MODELS
 
-void SimulationBox3D::addHollowPipe(double cx, double cy, double cz, double radius, double thickness, double height, char axis, double potential_value)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+const double mu0 = 1.25663706212e-6;
+
+// Parametric B sources ("B_sources" in config.json), kept as one structure of arrays per kind.
+// Positions in m; every source is axis-aligned ('x', 'y' or 'z' is the magnetization / coil axis).
+struct MagnetSources
 {
-    double r_outer2 = (radius + thickness / 2.0) * (radius + thickness / 2.0);
-    double r_inner2 = (radius - thickness / 2.0) * (radius - thickness / 2.0);
+    // ideal point dipoles: position and moment (A m^2)
+    std::vector<double> dipole_x, dipole_y, dipole_z, dipole_mx, dipole_my, dipole_mz;
 
-    for (int i = 0; i < nx; ++i)
-    {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
-        {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
+    // uniformly magnetized cuboids: corners, remanence (T) along +axis (negative Br flips it)
+    std::vector<double> cuboid_x0, cuboid_y0, cuboid_z0, cuboid_x1, cuboid_y1, cuboid_z1, cuboid_br;
+    std::vector<int> cuboid_axis;
 
-                bool inside = false;
-                if (axis == 'z')
-                {
-                    double r2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && z >= cz && z <= cz + height);
-                }
-                else if (axis == 'x')
-                {
-                    double r2 = (y - cy) * (y - cy) + (z - cz) * (z - cz);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && x >= cx && x <= cx + height);
-                }
-                else if (axis == 'y')
-                {
-                    double r2 = (x - cx) * (x - cx) + (z - cz) * (z - cz);
-                    inside = (r2 >= r_inner2 && r2 <= r_outer2 && y >= cy && y <= cy + height);
-                }
+    // circular current loops: centre, radius, current (A, counter-clockwise seen from +axis)
+    std::vector<double> loop_x, loop_y, loop_z, loop_radius, loop_current;
+    std::vector<int> loop_axis;
 
-                if (inside)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
-        }
+    bool empty() const { return dipole_x.empty() && cuboid_x0.empty() && loop_x.empty(); }
+
+    void addDipole(double x, double y, double z, double mx, double my, double mz)
+    {
+        dipole_x.push_back(x); dipole_y.push_back(y); dipole_z.push_back(z);
+        dipole_mx.push_back(mx); dipole_my.push_back(my); dipole_mz.push_back(mz);
+    }
+    void addCuboid(double x0, double y0, double z0, double x1, double y1, double z1, double br, int axis)
+    {
+        cuboid_x0.push_back(std::min(x0, x1)); cuboid_y0.push_back(std::min(y0, y1)); cuboid_z0.push_back(std::min(z0, z1));
+        cuboid_x1.push_back(std::max(x0, x1)); cuboid_y1.push_back(std::max(y0, y1)); cuboid_z1.push_back(std::max(z0, z1));
+        cuboid_br.push_back(br);
+        cuboid_axis.push_back(axis);
+    }
+    void addLoop(double x, double y, double z, double radius, double current, int axis)
+    {
+        loop_x.push_back(x); loop_y.push_back(y); loop_z.push_back(z);
+        loop_radius.push_back(radius); loop_current.push_back(current);
+        loop_axis.push_back(axis);
     }
+
+    // adds the field of every source at the n points to (bx, by, bz); the pusher calls field() once per
+    // particle and step, tabulate_magnet_sources passes a whole x plane of grid nodes
+    void fieldBatch(size_t n, const double *x, const double *y, const double *z, double *bx, double *by, double *bz) const;
+    void field(double x, double y, double z, double &bx, double &by, double &bz) const
+    {
+        fieldBatch(1, &x, &y, &z, &bx, &by, &bz);
+    }
+};
+
+// ln(v + sqrt(v^2 + c2)) without cancellation for v << 0
+static double log_v_plus_r(double v, double r, double c2)
+{
+    return v >= 0.0 ? std::log(v + r) : std::log(std::max(c2, 1e-300) / (r - v));
 }
 
-void SimulationBox3D::addEllipsoid(double cx, double cy, double cz, double rx, double ry, double rz, double potential_value)
+inline void MagnetSources::fieldBatch(size_t n, const double *x, const double *y, const double *z,
+                                      double *bx, double *by, double *bz) const
 {
-    for (int i = 0; i < nx; ++i)
+    const double k_dipole = mu0 / (4.0 * pi);
+    for (size_t s = 0; s < dipole_x.size(); ++s)
     {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
+        const double px = dipole_x[s], py = dipole_y[s], pz = dipole_z[s];
+        const double mx = dipole_mx[s], my = dipole_my[s], mz = dipole_mz[s];
+        for (size_t p = 0; p < n; ++p)
         {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
-            {
-                double z = k * dz;
-                double value = ((x - cx) / rx) * ((x - cx) / rx) + ((y - cy) / ry) * ((y - cy) / ry) + ((z - cz) / rz) * ((z - cz) / rz);
-                if (value <= 1.0)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
-            }
+            double rx = x[p] - px, ry = y[p] - py, rz = z[p] - pz;
+            double r2 = rx * rx + ry * ry + rz * rz + 1e-30;
+            double inv_r = 1.0 / std::sqrt(r2);
+            double inv_r3 = inv_r / r2, inv_r5 = inv_r3 / r2;
+            double m_dot_r = mx * rx + my * ry + mz * rz;
+            bx[p] += k_dipole * (3.0 * m_dot_r * rx * inv_r5 - mx * inv_r3);
+            by[p] += k_dipole * (3.0 * m_dot_r * ry * inv_r5 - my * inv_r3);
+            bz[p] += k_dipole * (3.0 * m_dot_r * rz * inv_r5 - mz * inv_r3);
         }
     }
-}
 
-void SimulationBox3D::addHyperboloid(double cx, double cy, double cz, double a, double b, double c, double waist, char axis, double potential_value)
-{
-    for (int i = 0; i < nx; ++i)
+    // A cuboid magnetized along w is two sheets of magnetic charge +-M on its w faces. In local
+    // coordinates (u, v, w) the field of one sheet follows from the corner sums below, with
+    // B = Br / (4 pi) (Iu, Iv, Iw) outside the magnet (+Br along w inside it).
+    for (size_t s = 0; s < cuboid_x0.size(); ++s)
     {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
+        const int w_axis = cuboid_axis[s], u_axis = (w_axis + 1) % 3, v_axis = (w_axis + 2) % 3;
+        const double lo[3] = {cuboid_x0[s], cuboid_y0[s], cuboid_z0[s]};
+        const double hi[3] = {cuboid_x1[s], cuboid_y1[s], cuboid_z1[s]};
+        const double scale = cuboid_br[s] / (4.0 * pi);
+        for (size_t p = 0; p < n; ++p)
         {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
+            const double r[3] = {x[p], y[p], z[p]};
+            double field[3] = {0.0, 0.0, 0.0}; // u, v, w
+            for (int face = 0; face < 2; ++face)
             {
-                double z = k * dz;
-                double val = 0.0;
-                if (axis == 'x')
-                {
-                    val = -((x - cx) / a) * ((x - cx) / a) + ((y - cy) / b) * ((y - cy) / b) + ((z - cz) / c) * ((z - cz) / c);
-                }
-                else if (axis == 'y')
-                {
-                    val = ((x - cx) / a) * ((x - cx) / a) - ((y - cy) / b) * ((y - cy) / b) + ((z - cz) / c) * ((z - cz) / c);
-                }
-                else if (axis == 'z')
-                {
-                    val = ((x - cx) / a) * ((x - cx) / a) + ((y - cy) / b) * ((y - cy) / b) - ((z - cz) / c) * ((z - cz) / c);
-                }
-
-                if (val <= waist * waist)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
+                double sign = face ? 1.0 : -1.0; // +M on the upper w face
+                double w = r[w_axis] - (face ? hi[w_axis] : lo[w_axis]);
+                double u[2] = {r[u_axis] - lo[u_axis], r[u_axis] - hi[u_axis]};
+                double v[2] = {r[v_axis] - lo[v_axis], r[v_axis] - hi[v_axis]};
+                for (int a = 0; a < 2; ++a)
+                    for (int b = 0; b < 2; ++b)
+                    {
+                        // + at (u1, v1) and (u2, v2), - at the mixed corners
+                        double corner = ((a + b) % 2 == 0) ? 1.0 : -1.0;
+                        double R = std::sqrt(u[a] * u[a] + v[b] * v[b] + w * w);
+                        field[0] -= sign * corner * log_v_plus_r(v[b], R, u[a] * u[a] + w * w);
+                        field[1] -= sign * corner * log_v_plus_r(u[a], R, v[b] * v[b] + w * w);
+                        if (w != 0.0)
+                            field[2] += sign * corner * std::atan(u[a] * v[b] / (w * R));
+                    }
             }
+            double b_local[3] = {scale * field[0], scale * field[1], scale * field[2]};
+            if (r[0] > lo[0] && r[0] < hi[0] && r[1] > lo[1] && r[1] < hi[1] && r[2] > lo[2] && r[2] < hi[2])
+                b_local[2] += cuboid_br[s];
+            double b_global[3];
+            b_global[u_axis] = b_local[0];
+            b_global[v_axis] = b_local[1];
+            b_global[w_axis] = b_local[2];
+            bx[p] += b_global[0];
+            by[p] += b_global[1];
+            bz[p] += b_global[2];
         }
     }
-}
 
-void SimulationBox3D::addPlane(double A, double B, double C, double D, double thickness, double potential_value)
-{
-    double norm = std::sqrt(A * A + B * B + C * C);
-    for (int i = 0; i < nx; ++i)
+    // Circular loop: exact off-axis field from the complete elliptic integrals K(k) and E(k)
+    for (size_t s = 0; s < loop_x.size(); ++s)
     {
-        double x = i * dx;
-        for (int j = 0; j < ny; ++j)
+        const int w_axis = loop_axis[s], u_axis = (w_axis + 1) % 3, v_axis = (w_axis + 2) % 3;
+        const double centre[3] = {loop_x[s], loop_y[s], loop_z[s]};
+        const double a = loop_radius[s], scale = mu0 * loop_current[s] / (2.0 * pi);
+        for (size_t p = 0; p < n; ++p)
         {
-            double y = j * dy;
-            for (int k = 0; k < nz; ++k)
+            const double r[3] = {x[p] - centre[0], y[p] - centre[1], z[p] - centre[2]};
+            double w = r[w_axis], rho = std::hypot(r[u_axis], r[v_axis]);
+            double b_local_w, b_rho;
+            double outer2 = (a + rho) * (a + rho) + w * w, inner2 = (a - rho) * (a - rho) + w * w;
+            if (inner2 < 1e-24 * a * a)
+                continue; // on the wire
+            if (rho < 1e-9 * a)
             {
-                double z = k * dz;
-                double dist = (A * x + B * y + C * z + D) / norm;
-                if (std::abs(dist) <= thickness / 2.0)
-                {
-                    int idx = index(i, j, k);
-                    potential[idx] = potential_value;
-                    geometry[idx] = potential_value;
-                    fixed_mask[idx] = true;
-                }
+                b_local_w = 0.5 * mu0 * loop_current[s] * a * a / std::pow(a * a + w * w, 1.5);
+                b_rho = 0.0;
+            }
+            else
+            {
+                double k = std::sqrt(4.0 * a * rho / outer2);
+                double K = std::comp_ellint_1(k), E = std::comp_ellint_2(k);
+                double root = std::sqrt(outer2);
+                b_local_w = scale / root * (K + (a * a - rho * rho - w * w) / inner2 * E);
+                b_rho = scale * w / (rho * root) * (-K + (a * a + rho * rho + w * w) / inner2 * E);
             }
+            double b_global[3];
+            b_global[w_axis] = b_local_w;
+            b_global[u_axis] = rho > 0.0 ? b_rho * r[u_axis] / rho : 0.0;
+            b_global[v_axis] = rho > 0.0 ? b_rho * r[v_axis] / rho : 0.0;
+            bx[p] += b_global[0];
+            by[p] += b_global[1];
+            bz[p] += b_global[2];
         }
     }
 }
 
-void SimulationBox3D::applyJacobi()
+// Reads the "B_sources" array of config.json (lengths in cm like the electrodes):
+//   {"type": "Dipole", "x", "y", "z", "mx", "my", "mz"}                      moment in A m^2
+//   {"type": "Magnet", "x0", "y0", "z0", "x1", "y1", "z1", "Br", "axis"}      cuboid, Br in T
+//   {"type": "MagnetPair", "cx", "cy", "cz", "size": [sx, sy, sz], "gap", "Br", "axis"}
+//        two equal cuboids on either side of a gap along axis, both magnetized along +axis
+//   {"type": "Loop", "cx", "cy", "cz", "radius", "current", "axis"}           current in A
+//   {"type": "Helmholtz", "cx", "cy", "cz", "radius", "current", "turns", "axis"}
+//   {"type": "Solenoid", "cx", "cy", "cz", "radius", "length", "current", "turns", "axis", "loops"}
+//        "loops" (default min(turns, 64)) current loops share the ampere-turns
+MagnetSources magnet_sources_from_json(const json &sources)
 {
-    std::vector<double> new_potential = potential;
+    MagnetSources result;
+    if (!sources.is_array())
+        return result;
 
-    // Interior points
-    for (int i = 1; i < nx - 1; ++i)
+    for (const auto &source : sources)
     {
-        for (int j = 1; j < ny - 1; ++j)
+        std::string type = source.value("type", "");
+        std::string axis_str = source.value("axis", "z");
+        int axis = axis_str.empty() ? 2 : axis_str[0] - 'x';
+        if (axis < 0 || axis > 2)
+            throw std::runtime_error("Unknown B source axis: " + axis_str);
+        double cx = source.value("cx", 0.0) * cm, cy = source.value("cy", 0.0) * cm, cz = source.value("cz", 0.0) * cm;
+        double centre[3] = {cx, cy, cz};
+
+        if (type == "Dipole")
+            result.addDipole(source.value("x", 0.0) * cm, source.value("y", 0.0) * cm, source.value("z", 0.0) * cm,
+                             source.value("mx", 0.0), source.value("my", 0.0), source.value("mz", 0.0));
+        else if (type == "Magnet")
+            result.addCuboid(source.value("x0", 0.0) * cm, source.value("y0", 0.0) * cm, source.value("z0", 0.0) * cm,
+                             source.value("x1", 0.0) * cm, source.value("y1", 0.0) * cm, source.value("z1", 0.0) * cm,
+                             source.value("Br", 0.0), axis);
+        else if (type == "MagnetPair")
         {
-            for (int k = 1; k < nz - 1; ++k)
+            std::vector<double> size = source.value("size", std::vector<double>{1.0, 1.0, 1.0});
+            if (size.size() != 3)
+                throw std::runtime_error("MagnetPair size needs 3 entries");
+            double gap = source.value("gap", 0.0) * cm;
+            for (int side = 0; side < 2; ++side)
             {
-                int idx = index(i, j, k);
-                if (!fixed_mask[idx])
+                double lo[3], hi[3];
+                for (int d = 0; d < 3; ++d)
                 {
-                    new_potential[idx] = (1.0 / 6.0) * (potential[index(i + 1, j, k)] + potential[index(i - 1, j, k)] +
-                                                        potential[index(i, j + 1, k)] + potential[index(i, j - 1, k)] +
-                                                        potential[index(i, j, k + 1)] + potential[index(i, j, k - 1)]);
+                    lo[d] = centre[d] - 0.5 * size[d] * cm;
+                    hi[d] = centre[d] + 0.5 * size[d] * cm;
                 }
+                double offset = 0.5 * gap + 0.5 * size[axis] * cm;
+                lo[axis] = centre[axis] + (side ? offset : -offset) - 0.5 * size[axis] * cm;
+                hi[axis] = lo[axis] + size[axis] * cm;
+                result.addCuboid(lo[0], lo[1], lo[2], hi[0], hi[1], hi[2], source.value("Br", 0.0), axis);
             }
         }
-    }
-
-    // Face points
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(0, j, k);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(1, j, k)] + potential[index(0, j + 1, k)] +
-                                                    potential[index(0, j - 1, k)] + potential[index(0, j, k + 1)] +
-                                                    potential[index(0, j, k - 1)]);
-
-            int idx1 = index(nx - 1, j, k);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(nx - 2, j, k)] + potential[index(nx - 1, j + 1, k)] +
-                                                     potential[index(nx - 1, j - 1, k)] + potential[index(nx - 1, j, k + 1)] +
-                                                     potential[index(nx - 1, j, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(i, 0, k);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, 0, k)] + potential[index(i - 1, 0, k)] +
-                                                    potential[index(i, 1, k)] + potential[index(i, 0, k + 1)] +
-                                                    potential[index(i, 0, k - 1)]);
-
-            int idx1 = index(i, ny - 1, k);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, ny - 1, k)] + potential[index(i - 1, ny - 1, k)] +
-                                                     potential[index(i, ny - 2, k)] + potential[index(i, ny - 1, k + 1)] +
-                                                     potential[index(i, ny - 1, k - 1)]);
-        }
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        for (int j = 1; j < ny - 1; ++j)
+        else if (type == "Loop" || type == "Helmholtz" || type == "Solenoid")
         {
-            int idx = index(i, j, 0);
-            if (!fixed_mask[idx])
-                new_potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, j, 0)] + potential[index(i - 1, j, 0)] +
-                                                    potential[index(i, j + 1, 0)] + potential[index(i, j - 1, 0)] +
-                                                    potential[index(i, j, 1)]);
-
-            int idx1 = index(i, j, nz - 1);
-            if (!fixed_mask[idx1])
-                new_potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, j, nz - 1)] + potential[index(i - 1, j, nz - 1)] +
-                                                     potential[index(i, j + 1, nz - 1)] + potential[index(i, j - 1, nz - 1)] +
-                                                     potential[index(i, j, nz - 2)]);
+            double radius = source.value("radius", 0.0) * cm;
+            double ampere_turns = source.value("current", 0.0) * source.value("turns", 1.0);
+            std::vector<double> offsets;
+            if (type == "Loop")
+                offsets = {0.0};
+            else if (type == "Helmholtz")
+                offsets = {-0.5 * radius, 0.5 * radius};
+            else
+            {
+                double length = source.value("length", 0.0) * cm;
+                int loops = std::max(1, source.value("loops", std::min(static_cast<int>(source.value("turns", 1.0)), 64)));
+                for (int l = 0; l < loops; ++l)
+                    offsets.push_back(length * ((l + 0.5) / loops - 0.5));
+            }
+            // each coil of a Helmholtz pair carries all turns, a solenoid spreads them over its loops
+            double current = type == "Solenoid" ? ampere_turns / offsets.size() : ampere_turns;
+            for (double offset : offsets)
+            {
+                double position[3] = {cx, cy, cz};
+                position[axis] += offset;
+                result.addLoop(position[0], position[1], position[2], radius, current, axis);
+            }
         }
+        else
+            throw std::runtime_error("Unknown B source type: " + type);
     }
-
-    // Edge points (4 neighbors)
-    for (int k = 1; k < nz - 1; ++k)
-    {
-        int idx = index(0, 0, k);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(1, 0, k)] + potential[index(0, 1, k)] +
-                                                potential[index(0, 0, k + 1)] + potential[index(0, 0, k - 1)]);
-
-        int idx1 = index(0, ny - 1, k);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(1, ny - 1, k)] + potential[index(0, ny - 2, k)] +
-                                                 potential[index(0, ny - 1, k + 1)] + potential[index(0, ny - 1, k - 1)]);
-
-        int idx2 = index(nx - 1, 0, k);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(nx - 2, 0, k)] + potential[index(nx - 1, 1, k)] +
-                                                 potential[index(nx - 1, 0, k + 1)] + potential[index(nx - 1, 0, k - 1)]);
-
-        int idx3 = index(nx - 1, ny - 1, k);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, ny - 1, k)] + potential[index(nx - 1, ny - 2, k)] +
-                                                 potential[index(nx - 1, ny - 1, k + 1)] + potential[index(nx - 1, ny - 1, k - 1)]);
-    }
-
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        int idx = index(0, j, 0);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(1, j, 0)] + potential[index(0, j + 1, 0)] +
-                                                potential[index(0, j - 1, 0)] + potential[index(0, j, 1)]);
-
-        int idx1 = index(nx - 1, j, 0);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(nx - 2, j, 0)] + potential[index(nx - 1, j + 1, 0)] +
-                                                 potential[index(nx - 1, j - 1, 0)] + potential[index(nx - 1, j, 1)]);
-
-        int idx2 = index(0, j, nz - 1);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(1, j, nz - 1)] + potential[index(0, j + 1, nz - 1)] +
-                                                 potential[index(0, j - 1, nz - 1)] + potential[index(0, j, nz - 2)]);
-
-        int idx3 = index(nx - 1, j, nz - 1);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, j, nz - 1)] + potential[index(nx - 1, j + 1, nz - 1)] +
-                                                 potential[index(nx - 1, j - 1, nz - 1)] + potential[index(nx - 1, j, nz - 2)]);
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        int idx = index(i, 0, 0);
-        if (!fixed_mask[idx])
-            new_potential[idx] = (1.0 / 4.0) * (potential[index(i + 1, 0, 0)] + potential[index(i - 1, 0, 0)] +
-                                                potential[index(i, 1, 0)] + potential[index(i, 0, 1)]);
-
-        int idx1 = index(i, ny - 1, 0);
-        if (!fixed_mask[idx1])
-            new_potential[idx1] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, 0)] + potential[index(i - 1, ny - 1, 0)] +
-                                                 potential[index(i, ny - 2, 0)] + potential[index(i, ny - 1, 1)]);
-
-        int idx2 = index(i, 0, nz - 1);
-        if (!fixed_mask[idx2])
-            new_potential[idx2] = (1.0 / 4.0) * (potential[index(i + 1, 0, nz - 1)] + potential[index(i - 1, 0, nz - 1)] +
-                                                 potential[index(i, 1, nz - 1)] + potential[index(i, 0, nz - 2)]);
-
-        int idx3 = index(i, ny - 1, nz - 1);
-        if (!fixed_mask[idx3])
-            new_potential[idx3] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, nz - 1)] + potential[index(i - 1, ny - 1, nz - 1)] +
-                                                 potential[index(i, ny - 2, nz - 1)] + potential[index(i, ny - 1, nz - 2)]);
-    }
-
-    // Corner points (3 neighbors)
-    if (!fixed_mask[index(0, 0, 0)])
-        new_potential[index(0, 0, 0)] = (1.0 / 3.0) * (potential[index(1, 0, 0)] + potential[index(0, 1, 0)] + potential[index(0, 0, 1)]);
-
-    if (!fixed_mask[index(nx - 1, 0, 0)])
-        new_potential[index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, 0)] + potential[index(nx - 1, 1, 0)] + potential[index(nx - 1, 0, 1)]);
-
-    if (!fixed_mask[index(0, ny - 1, 0)])
-        new_potential[index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(1, ny - 1, 0)] + potential[index(0, ny - 2, 0)] + potential[index(0, ny - 1, 1)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, 0)])
-        new_potential[index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, 0)] + potential[index(nx - 1, ny - 2, 0)] + potential[index(nx - 1, ny - 1, 1)]);
-
-    if (!fixed_mask[index(0, 0, nz - 1)])
-        new_potential[index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(1, 0, nz - 1)] + potential[index(0, 1, nz - 1)] + potential[index(0, 0, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, 0, nz - 1)])
-        new_potential[index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, nz - 1)] + potential[index(nx - 1, 1, nz - 1)] + potential[index(nx - 1, 0, nz - 2)]);
-
-    if (!fixed_mask[index(0, ny - 1, nz - 1)])
-        new_potential[index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(1, ny - 1, nz - 1)] + potential[index(0, ny - 2, nz - 1)] + potential[index(0, ny - 1, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, nz - 1)])
-        new_potential[index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, nz - 1)] + potential[index(nx - 1, ny - 2, nz - 1)] + potential[index(nx - 1, ny - 1, nz - 2)]);
-
-    // Final update
-    potential = std::move(new_potential);
+    return result;
 }
 
-void SimulationBox3D::applyGaussSeidel()
+// Samples the sources (every node of a grid, one batch per x plane) into a B map file, so the pusher
+// reads one interpolated table instead of summing every source at every step
+void tabulate_magnet_sources(const MagnetSources &sources, const std::string &bin_path,
+                             int nx, int ny, int nz, double dx, double dy, double dz)
 {
-    // Interior points
-    for (int i = 1; i < nx - 1; ++i)
+    BMapHeader header = {{'B', 'F', 'I', 'E', 'L', 'D', 'v', '1'}, nx, ny, nz, 0, 0.0, 0.0, 0.0, dx, dy, dz};
+    size_t plane = static_cast<size_t>(ny) * nz;
+    std::vector<double> values(3 * plane * nx);
+    parallel_for(0, nx, [&](int first, int last)
     {
-        for (int j = 1; j < ny - 1; ++j)
+        std::vector<double> x(plane), y(plane), z(plane), bx(plane), by(plane), bz(plane);
+        for (int i = first; i < last; ++i)
         {
-            for (int k = 1; k < nz - 1; ++k)
-            {
-                int idx = index(i, j, k);
-                if (!fixed_mask[idx])
+            for (int j = 0; j < ny; ++j)
+                for (int k = 0; k < nz; ++k)
                 {
-                    potential[idx] = (1.0 / 6.0) * (potential[index(i + 1, j, k)] + potential[index(i - 1, j, k)] +
-                                                    potential[index(i, j + 1, k)] + potential[index(i, j - 1, k)] +
-                                                    potential[index(i, j, k + 1)] + potential[index(i, j, k - 1)]);
+                    size_t n = static_cast<size_t>(j) * nz + k;
+                    x[n] = i * dx;
+                    y[n] = j * dy;
+                    z[n] = k * dz;
                 }
+            std::fill(bx.begin(), bx.end(), 0.0);
+            std::fill(by.begin(), by.end(), 0.0);
+            std::fill(bz.begin(), bz.end(), 0.0);
+            sources.fieldBatch(plane, x.data(), y.data(), z.data(), bx.data(), by.data(), bz.data());
+            for (size_t n = 0; n < plane; ++n)
+            {
+                size_t node = i * plane + n;
+                values[3 * node] = bx[n];
+                values[3 * node + 1] = by[n];
+                values[3 * node + 2] = bz[n];
             }
         }
-    }
+    });
 
-    // Face points (excluding edges and corners)
-    for (int j = 1; j < ny - 1; ++j)
+    std::string partial = bin_path + ".part";
     {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(0, j, k);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(1, j, k)] + potential[index(0, j + 1, k)] +
-                                                potential[index(0, j - 1, k)] + potential[index(0, j, k + 1)] +
-                                                potential[index(0, j, k - 1)]);
-
-            int idx1 = index(nx - 1, j, k);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(nx - 2, j, k)] + potential[index(nx - 1, j + 1, k)] +
-                                                 potential[index(nx - 1, j - 1, k)] + potential[index(nx - 1, j, k + 1)] +
-                                                 potential[index(nx - 1, j, k - 1)]);
-        }
+        std::ofstream out(partial, std::ios::binary);
+        if (!out)
+            throw std::runtime_error("Could not write B field table: " + bin_path);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
     }
+    fs::rename(partial, bin_path);
+}
 
-    for (int i = 1; i < nx - 1; ++i)
+MagnetSources B_sources;                        // summed at every step, unless tabulated
+std::unique_ptr<MagneticFieldMap> B_sources_map; // B_sources sampled on the grid ("B_tabulate")
+
+// Total B at a point: uniform field + field map + analytic sources
+void magnetic_field(double x, double y, double z, double &bx, double &by, double &bz)
+{
+    bx = Bx;
+    by = By;
+    bz = Bz;
+    double map_x, map_y, map_z;
+    if (B_map && B_map->at(x, y, z, map_x, map_y, map_z))
     {
-        for (int k = 1; k < nz - 1; ++k)
-        {
-            int idx = index(i, 0, k);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, 0, k)] + potential[index(i - 1, 0, k)] +
-                                                potential[index(i, 1, k)] + potential[index(i, 0, k + 1)] +
-                                                potential[index(i, 0, k - 1)]);
-
-            int idx1 = index(i, ny - 1, k);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, ny - 1, k)] + potential[index(i - 1, ny - 1, k)] +
-                                                 potential[index(i, ny - 2, k)] + potential[index(i, ny - 1, k + 1)] +
-                                                 potential[index(i, ny - 1, k - 1)]);
-        }
+        bx += map_x;
+        by += map_y;
+        bz += map_z;
     }
-
-    for (int i = 1; i < nx - 1; ++i)
+    if (B_sources_map)
     {
-        for (int j = 1; j < ny - 1; ++j)
+        if (B_sources_map->at(x, y, z, map_x, map_y, map_z))
         {
-            int idx = index(i, j, 0);
-            if (!fixed_mask[idx])
-                potential[idx] = (1.0 / 5.0) * (potential[index(i + 1, j, 0)] + potential[index(i - 1, j, 0)] +
-                                                potential[index(i, j + 1, 0)] + potential[index(i, j - 1, 0)] +
-                                                potential[index(i, j, 1)]);
-
-            int idx1 = index(i, j, nz - 1);
-            if (!fixed_mask[idx1])
-                potential[idx1] = (1.0 / 5.0) * (potential[index(i + 1, j, nz - 1)] + potential[index(i - 1, j, nz - 1)] +
-                                                 potential[index(i, j + 1, nz - 1)] + potential[index(i, j - 1, nz - 1)] +
-                                                 potential[index(i, j, nz - 2)]);
+            bx += map_x;
+            by += map_y;
+            bz += map_z;
         }
     }
-
-    // Edge points (4 neighbors)
-    for (int k = 1; k < nz - 1; ++k)
-    {
-        // x edges at y=0 and y=ny-1
-        int idx = index(0, 0, k);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(1, 0, k)] + potential[index(0, 1, k)] +
-                                            potential[index(0, 0, k + 1)] + potential[index(0, 0, k - 1)]);
-
-        int idx1 = index(0, ny - 1, k);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(1, ny - 1, k)] + potential[index(0, ny - 2, k)] +
-                                             potential[index(0, ny - 1, k + 1)] + potential[index(0, ny - 1, k - 1)]);
-
-        int idx2 = index(nx - 1, 0, k);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(nx - 2, 0, k)] + potential[index(nx - 1, 1, k)] +
-                                             potential[index(nx - 1, 0, k + 1)] + potential[index(nx - 1, 0, k - 1)]);
-
-        int idx3 = index(nx - 1, ny - 1, k);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, ny - 1, k)] + potential[index(nx - 1, ny - 2, k)] +
-                                             potential[index(nx - 1, ny - 1, k + 1)] + potential[index(nx - 1, ny - 1, k - 1)]);
-    }
-
-    for (int j = 1; j < ny - 1; ++j)
-    {
-        int idx = index(0, j, 0);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(1, j, 0)] + potential[index(0, j + 1, 0)] +
-                                            potential[index(0, j - 1, 0)] + potential[index(0, j, 1)]);
-
-        int idx1 = index(nx - 1, j, 0);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(nx - 2, j, 0)] + potential[index(nx - 1, j + 1, 0)] +
-                                             potential[index(nx - 1, j - 1, 0)] + potential[index(nx - 1, j, 1)]);
-
-        int idx2 = index(0, j, nz - 1);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(1, j, nz - 1)] + potential[index(0, j + 1, nz - 1)] +
-                                             potential[index(0, j - 1, nz - 1)] + potential[index(0, j, nz - 2)]);
-
-        int idx3 = index(nx - 1, j, nz - 1);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(nx - 2, j, nz - 1)] + potential[index(nx - 1, j + 1, nz - 1)] +
-                                             potential[index(nx - 1, j - 1, nz - 1)] + potential[index(nx - 1, j, nz - 2)]);
-    }
-
-    for (int i = 1; i < nx - 1; ++i)
-    {
-        int idx = index(i, 0, 0);
-        if (!fixed_mask[idx])
-            potential[idx] = (1.0 / 4.0) * (potential[index(i + 1, 0, 0)] + potential[index(i - 1, 0, 0)] +
-                                            potential[index(i, 1, 0)] + potential[index(i, 0, 1)]);
-
-        int idx1 = index(i, ny - 1, 0);
-        if (!fixed_mask[idx1])
-            potential[idx1] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, 0)] + potential[index(i - 1, ny - 1, 0)] +
-                                             potential[index(i, ny - 2, 0)] + potential[index(i, ny - 1, 1)]);
-
-        int idx2 = index(i, 0, nz - 1);
-        if (!fixed_mask[idx2])
-            potential[idx2] = (1.0 / 4.0) * (potential[index(i + 1, 0, nz - 1)] + potential[index(i - 1, 0, nz - 1)] +
-                                             potential[index(i, 1, nz - 1)] + potential[index(i, 0, nz - 2)]);
-
-        int idx3 = index(i, ny - 1, nz - 1);
-        if (!fixed_mask[idx3])
-            potential[idx3] = (1.0 / 4.0) * (potential[index(i + 1, ny - 1, nz - 1)] + potential[index(i - 1, ny - 1, nz - 1)] +
-                                             potential[index(i, ny - 2, nz - 1)] + potential[index(i, ny - 1, nz - 2)]);
-    }
-
-    // Corners (3 neighbors)
-    if (!fixed_mask[index(0, 0, 0)])
-        potential[index(0, 0, 0)] = (1.0 / 3.0) * (potential[index(1, 0, 0)] + potential[index(0, 1, 0)] + potential[index(0, 0, 1)]);
-
-    if (!fixed_mask[index(nx - 1, 0, 0)])
-        potential[index(nx - 1, 0, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, 0)] + potential[index(nx - 1, 1, 0)] + potential[index(nx - 1, 0, 1)]);
-
-    if (!fixed_mask[index(0, ny - 1, 0)])
-        potential[index(0, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(1, ny - 1, 0)] + potential[index(0, ny - 2, 0)] + potential[index(0, ny - 1, 1)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, 0)])
-        potential[index(nx - 1, ny - 1, 0)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, 0)] + potential[index(nx - 1, ny - 2, 0)] + potential[index(nx - 1, ny - 1, 1)]);
-
-    if (!fixed_mask[index(0, 0, nz - 1)])
-        potential[index(0, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(1, 0, nz - 1)] + potential[index(0, 1, nz - 1)] + potential[index(0, 0, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, 0, nz - 1)])
-        potential[index(nx - 1, 0, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, 0, nz - 1)] + potential[index(nx - 1, 1, nz - 1)] + potential[index(nx - 1, 0, nz - 2)]);
-
-    if (!fixed_mask[index(0, ny - 1, nz - 1)])
-        potential[index(0, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(1, ny - 1, nz - 1)] + potential[index(0, ny - 2, nz - 1)] + potential[index(0, ny - 1, nz - 2)]);
-
-    if (!fixed_mask[index(nx - 1, ny - 1, nz - 1)])
-        potential[index(nx - 1, ny - 1, nz - 1)] = (1.0 / 3.0) * (potential[index(nx - 2, ny - 1, nz - 1)] + potential[index(nx - 1, ny - 2, nz - 1)] + potential[index(nx - 1, ny - 1, nz - 2)]);
+    else if (!B_sources.empty())
+        B_sources.field(x, y, z, bx, by, bz);
 }
 
 /*
@@ -781,20 +593,105 @@ struct Particle
     std::vector<double> posz;
 };
 
-void propagator(Particle &p,
+// one entry of the particle ensemble read from the ParticleConfig_*.json files
+struct ParticleRun
+{
+    Particle initial;
+    double t_max;
+    double dt;
+    double current; // beam current carried by this particle (A), only used for space charge
+};
+
+// Cell of (x, y, z) folded into the meshed half as in the pusher; -1 outside the grid
+template <class Layout>
+int pusher_cell(const Layout &L, const SimulationBox3D &box, double x, double y, double z)
+{
+    int i = static_cast<int>(x / box.dx);
+    int j = static_cast<int>(y / box.dy);
+    int k = static_cast<int>(z / box.dz);
+    box.foldIndex(i, j);
+    if (i < 0 || i >= box.nx || j < 0 || j >= box.ny || k < 0 || k >= box.nz)
+        return -1;
+    return L.index(i, j, k);
+}
+
+// Swept hit check of one step from (x0, y0, z0) to (x1, y1, z1) against the electrode distance field:
+// the segment is walked in hops as long as the clearance around the current cell (node distance less
+// two cell diagonals, so it bounds the distance to any point of an electrode cell) and at most half a
+// cell, so plates thinner than a step are not tunnelled through. On a hit, (hx, hy, hz) is the last
+// free point before the electrode, bisected down to 1/1000 of a cell.
+template <class Layout>
+bool swept_hit(const Layout &L, const SimulationBox3D &box,
+               double x0, double y0, double z0, double x1, double y1, double z1,
+               double &hx, double &hy, double &hz)
+{
+    double ux = x1 - x0, uy = y1 - y0, uz = z1 - z0;
+    double length = std::sqrt(ux * ux + uy * uy + uz * uz);
+    if (length == 0.0)
+        return false;
+    ux /= length;
+    uy /= length;
+    uz /= length;
+
+    double min_hop = 0.5 * std::min({box.dx, box.dy, box.dz});
+    double margin = 2.0 * std::sqrt(box.dx * box.dx + box.dy * box.dy + box.dz * box.dz);
+    double s = 0.0, free_s = 0.0;
+    while (true)
+    {
+        double x = x0 + s * ux, y = y0 + s * uy, z = z0 + s * uz;
+        // leaving the domain is reported by the boundary check of the next step
+        if (!(x >= 0 && x < box.full_lx && y >= 0 && y < box.full_ly && z >= 0 && z < box.lz))
+            return false;
+        int idx = pusher_cell(L, box, x, y, z);
+        if (idx < 0)
+            return false;
+        if (box.fixed_mask[idx])
+        {
+            for (int bisection = 0; bisection < 10; ++bisection)
+            {
+                double mid = 0.5 * (free_s + s);
+                int mid_idx = pusher_cell(L, box, x0 + mid * ux, y0 + mid * uy, z0 + mid * uz);
+                (mid_idx >= 0 && box.fixed_mask[mid_idx] ? s : free_s) = mid;
+            }
+            hx = x0 + free_s * ux;
+            hy = y0 + free_s * uy;
+            hz = z0 + free_s * uz;
+            return true;
+        }
+        if (s >= length)
+            return false;
+        free_s = s;
+        s = std::min(length, s + std::max(box.electrode_distance[idx] - margin, min_hop));
+    }
+}
+
+// If rho is given, the particle is treated as a beamlet carrying the given current (A)
+// and deposits current*dt of charge at every step (trajectory / gun-code space charge).
+// With the electrode distance field computed, every step is also swept for electrode hits, and
+// max_step_multiplier > 1 lets the pusher merge up to that many steps where the clearance to the
+// electrodes is large against the step length (the field varies on the scale of that clearance)
+// and the cyclotron phase per merged step stays below 0.1 rad.
+template <class Layout>
+void propagator(const Layout &L,
+                Particle &p,
                 const SimulationBox3D &box,
-                double t_max = 0.0,
-                double dt = 0.001) // constant B field
+                double t_max,
+                double dt,
+                std::vector<double> *rho,
+                double current,
+                FieldInterpolation interpolation,
+                int max_step_multiplier) // constant B field
 {
-    double t = 0.0;
     int steps = static_cast<int>(t_max / dt);
     double qmdt2 = (p.q / p.m) * (dt / 2.0);
+    bool sweep = box.electrode_distance.size() == box.potential.size();
+    double margin = 2.0 * std::sqrt(box.dx * box.dx + box.dy * box.dy + box.dz * box.dz);
 
     for (int step = 0; step < steps; ++step)
     {
-        // Boundary check
-        if (p.x < 0 || p.x >= box.lx ||
-            p.y < 0 || p.y >= box.ly ||
+        // Boundary check (against the full domain when the box only meshes a symmetric half)
+        if (p.x < 0 || p.x >= box.full_lx ||
+            p.y < 0 || p.y >= box.full_ly ||
             p.z < 0 || p.z >= box.lz)
         {
             std::cout << "Particle left the domain at step " << step << std::endl;
@@ -806,6 +703,10 @@ void propagator(Particle &p,
         int j = static_cast<int>(p.y / box.dy);
         int k = static_cast<int>(p.z / box.dz);
 
+        // Fold cells beyond a mirror plane into the meshed half; the field component normal to the plane flips sign
+        double flip_x, flip_y;
+        box.foldIndex(i, j, &flip_x, &flip_y);
+
         // Check if inside grid bounds
         if (i < 0 || i >= box.nx ||
             j < 0 || j >= box.ny ||
@@ -816,32 +717,56 @@ void propagator(Particle &p,
         }
 
         // Check if on electrode
-        if (box.fixed_mask[box.index(i, j, k)])
+        int idx = L.index(i, j, k);
+        if (box.fixed_mask[idx])
         {
             std::cout << "Particle hit an electrode at step " << step << std::endl;
             break;
         }
 
-        // Interpolate E field (simple nearest-neighbor for now)
-        double Ex = 0.0, Ey = 0.0, Ez = 0.0;
+        // Merge steps far from the electrodes
+        int multiplier = 1;
+        if (sweep && max_step_multiplier > 1)
+        {
+            double travel = std::sqrt(p.vx * p.vx + p.vy * p.vy + p.vz * p.vz) * dt;
+            double clearance = box.electrode_distance[idx] - margin;
+            if (travel > 0.0 && clearance > 4.0 * travel)
+                multiplier = static_cast<int>(std::min<double>({0.25 * clearance / travel,
+                                                                 static_cast<double>(max_step_multiplier),
+                                                                 static_cast<double>(steps - step)}));
+            if (multiplier > 1)
+            {
+                double bx, by, bz;
+                magnetic_field(p.x, p.y, p.z, bx, by, bz);
+                double phase = std::abs(p.q / p.m) * std::sqrt(bx * bx + by * by + bz * bz) * dt;
+                if (phase > 0.0)
+                    multiplier = static_cast<int>(std::min<double>(multiplier, std::max(1.0, 0.1 / phase)));
+            }
+        }
+        double step_dt = dt * multiplier, step_qmdt2 = qmdt2 * multiplier;
 
-        // Use finite differences to approximate E = -∇φ
-        if (i > 0 && i < box.nx - 1)
-            Ex = -(box.potential[box.index(i + 1, j, k)] - box.potential[box.index(i - 1, j, k)]) / (2.0 * box.dx);
-        if (j > 0 && j < box.ny - 1)
-            Ey = -(box.potential[box.index(i, j + 1, k)] - box.potential[box.index(i, j - 1, k)]) / (2.0 * box.dy);
-        if (k > 0 && k < box.nz - 1)
-            Ez = -(box.potential[box.index(i, j, k + 1)] - box.potential[box.index(i, j, k - 1)]) / (2.0 * box.dz);
+        // Interpolate E field from the precomputed field grids
+        double Ex, Ey, Ez;
+        if (interpolation != FieldInterpolation::Nearest)
+            interpolated_field(L, box, interpolation, p.x, p.y, p.z, Ex, Ey, Ez);
+        else
+        {
+            Ex = flip_x * box.field_x[idx];
+            Ey = flip_y * box.field_y[idx];
+            Ez = box.field_z[idx];
+        }
 
         // Half-step velocity
-        double vx_minus = p.vx + qmdt2 * Ex;
-        double vy_minus = p.vy + qmdt2 * Ey;
-        double vz_minus = p.vz + qmdt2 * Ez;
+        double vx_minus = p.vx + step_qmdt2 * Ex;
+        double vy_minus = p.vy + step_qmdt2 * Ey;
+        double vz_minus = p.vz + step_qmdt2 * Ez;
 
         // Magnetic rotation
-        double tx = qmdt2 * Bx;
-        double ty = qmdt2 * By;
-        double tz = qmdt2 * Bz;
+        double bx, by, bz;
+        magnetic_field(p.x, p.y, p.z, bx, by, bz);
+        double tx = step_qmdt2 * bx;
+        double ty = step_qmdt2 * by;
+        double tz = step_qmdt2 * bz;
 
         double t2 = tx * tx + ty * ty + tz * tz;
         double sx = 2 * tx / (1 + t2);
@@ -857,24 +782,373 @@ void propagator(Particle &p,
         double vz_plus = vz_minus + (vpx * sy - vpy * sx);
 
         // Final update
-        p.vx = vx_plus + qmdt2 * Ex;
-        p.vy = vy_plus + qmdt2 * Ey;
-        p.vz = vz_plus + qmdt2 * Ez;
+        p.vx = vx_plus + step_qmdt2 * Ex;
+        p.vy = vy_plus + step_qmdt2 * Ey;
+        p.vz = vz_plus + step_qmdt2 * Ez;
+
+        // Position update
+        double x0 = p.x, y0 = p.y, z0 = p.z;
+        p.x += p.vx * step_dt;
+        p.y += p.vy * step_dt;
+        p.z += p.vz * step_dt;
+
+        // Electrode crossed during the step (thin plate): end the track where it was hit
+        double hx, hy, hz;
+        if (sweep && swept_hit(L, box, x0, y0, z0, p.x, p.y, p.z, hx, hy, hz))
+        {
+            p.x = hx;
+            p.y = hy;
+            p.z = hz;
+            p.posx.push_back(p.x);
+            p.posy.push_back(p.y);
+            p.posz.push_back(p.z);
+            std::cout << "Particle hit an electrode at step " << step << std::endl;
+            break;
+        }
+
+        if (rho)
+            box.depositCharge(*rho, p.x, p.y, p.z, current * step_dt);
+
+        // Save trajectory
+        p.posx.push_back(p.x);
+        p.posy.push_back(p.y);
+        p.posz.push_back(p.z);
+        step += multiplier - 1;
+    }
+
+    // Final stats
+    p.v = std::sqrt(p.vx * p.vx + p.vy * p.vy + p.vz * p.vz);
+    p.energy = 0.5 * p.m * p.v * p.v;
+}
+
+// field lookups go through the layout the box was built with
+void propagator(Particle &p,
+                const SimulationBox3D &box,
+                double t_max = 0.0,
+                double dt = 0.001,
+                std::vector<double> *rho = nullptr,
+                double current = 0.0,
+                FieldInterpolation interpolation = FieldInterpolation::Nearest,
+                int max_step_multiplier = 1)
+{
+    if (box.field_x.size() != box.potential.size())
+        throw std::runtime_error("E field not computed: call computeField() after solving");
+    if (interpolation == FieldInterpolation::Bspline && box.spline_coefficients.size() != box.potential.size())
+        throw std::runtime_error("B-spline not computed: call computeSplineCoefficients() after solving");
+    if (box.brick_storage)
+        propagator(box.brick_layout, p, box, t_max, dt, rho, current, interpolation, max_step_multiplier);
+    else
+        propagator(RowMajorLayout(box.nx, box.ny, box.nz), p, box, t_max, dt, rho, current, interpolation, max_step_multiplier);
+}
+
+
+
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                FIELD LINES AND EQUIPOTENTIALS
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// Curves traced from seed points through the interpolated field ("trace" in config.json): E-field lines
+// (dr/ds = +-E/|E|) or equipotential contours on the slice through the seed (dr/ds = n x E/|E| with n
+// the slice normal), integrated in arc length with adaptive Dormand-Prince RK45. A curve ends when it
+// leaves the domain, enters an electrode cell, reaches a point without field, closes on its seed
+// (equipotentials) or runs past max_length / max_points. Seeds are traced in parallel.
+struct TraceSettings
+{
+    FieldInterpolation interpolation = FieldInterpolation::Trilinear;
+    int plane_axis = -1;      // equipotentials: normal of the slice (0 x, 1 y, 2 z); -1 traces field lines
+    int direction = 0;        // +1 along E (or counter-clockwise about the normal), -1 against, 0 both ways
+    double tolerance = 1e-6;  // local position error per step (m)
+    double max_step = 0.0;    // m, 0 = smallest grid spacing
+    double max_length = 0.0;  // m, 0 = four times the box diagonal
+    int max_points = 20000;   // per curve
+};
+
+struct Polyline
+{
+    std::vector<double> points; // x y z per vertex (m)
+    double value;               // potential at the seed (V)
+};
+
+// Same cell test as the pusher: true outside the full domain or in an electrode cell
+template <class Layout>
+bool trace_blocked(const Layout &L, const SimulationBox3D &box, double x, double y, double z)
+{
+    if (!(x >= 0 && x < box.full_lx && y >= 0 && y < box.full_ly && z >= 0 && z < box.lz))
+        return true;
+    int cell = pusher_cell(L, box, x, y, z);
+    return cell < 0 || box.fixed_mask[cell] != 0;
+}
+
+// Unit tangent of the traced curve at r; false where the field (in the slice) vanishes
+template <class Layout>
+bool trace_direction(const Layout &L, const SimulationBox3D &box, const TraceSettings &settings, double field_floor,
+                     double sign, const std::array<double, 3> &r, std::array<double, 3> &d)
+{
+    // stage points may overshoot the domain; the field is read on its edge
+    double x = std::clamp(r[0], 0.0, box.full_lx);
+    double y = std::clamp(r[1], 0.0, box.full_ly);
+    double z = std::clamp(r[2], 0.0, box.lz);
+    std::array<double, 3> E;
+    interpolated_field(L, box, settings.interpolation, x, y, z, E[0], E[1], E[2]);
+
+    double floor = field_floor;
+    if (settings.plane_axis >= 0)
+    {
+        // n x E for the unit normal n = e_axis; the normal component of E drops out. Where E is
+        // nearly normal to the slice the contour shrinks to a point (its radius is about this ratio
+        // times that of the equipotential surface), so stop there as well.
+        int a = settings.plane_axis, b = (a + 1) % 3, c = (a + 2) % 3;
+        floor = std::max(floor, 1e-3 * std::sqrt(E[0] * E[0] + E[1] * E[1] + E[2] * E[2]));
+        d[a] = 0.0;
+        d[b] = -E[c];
+        d[c] = E[b];
+    }
+    else
+        d = E;
+
+    double norm = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if (!(norm > floor))
+        return false;
+    for (double &v : d)
+        v *= sign / norm;
+    return true;
+}
+
+// One branch of a curve from the seed (sign = +-1); the seed itself is not stored.
+// Returns true if an equipotential closed on its seed (the seed is then appended as the last vertex).
+template <class Layout>
+bool trace_branch(const Layout &L, const SimulationBox3D &box, const TraceSettings &settings, double field_floor,
+                  const std::array<double, 3> &seed, double sign, std::vector<double> &points)
+{
+    // Dormand-Prince 5(4) tableau
+    static constexpr double a21 = 1.0 / 5.0;
+    static constexpr double a31 = 3.0 / 40.0, a32 = 9.0 / 40.0;
+    static constexpr double a41 = 44.0 / 45.0, a42 = -56.0 / 15.0, a43 = 32.0 / 9.0;
+    static constexpr double a51 = 19372.0 / 6561.0, a52 = -25360.0 / 2187.0, a53 = 64448.0 / 6561.0, a54 = -212.0 / 729.0;
+    static constexpr double a61 = 9017.0 / 3168.0, a62 = -355.0 / 33.0, a63 = 46732.0 / 5247.0, a64 = 49.0 / 176.0,
+                            a65 = -5103.0 / 18656.0;
+    static constexpr double b1 = 35.0 / 384.0, b3 = 500.0 / 1113.0, b4 = 125.0 / 192.0, b5 = -2187.0 / 6784.0,
+                            b6 = 11.0 / 84.0;
+    static constexpr double e1 = 71.0 / 57600.0, e3 = -71.0 / 16695.0, e4 = 71.0 / 1920.0, e5 = -17253.0 / 339200.0,
+                            e6 = 22.0 / 525.0, e7 = -1.0 / 40.0;
+
+    const double min_step = 1e-3 * settings.max_step;
+    std::array<double, 3> r = seed, previous, k1, k2, k3, k4, k5, k6, k7, y;
+    if (!trace_direction(L, box, settings, field_floor, sign, r, k1))
+        return false;
+
+    double h = 0.5 * settings.max_step, length = 0.0;
+    size_t max_values = 3 * static_cast<size_t>(settings.max_points);
+    auto stage = [&](std::array<double, 3> &k, std::initializer_list<std::pair<double, const std::array<double, 3> *>> terms)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            y[c] = r[c];
+            for (const auto &term : terms)
+                y[c] += h * term.first * (*term.second)[c];
+        }
+        return trace_direction(L, box, settings, field_floor, sign, y, k);
+    };
+
+    while (points.size() < max_values && length < settings.max_length)
+    {
+        bool ok = stage(k2, {{a21, &k1}}) &&
+                  stage(k3, {{a31, &k1}, {a32, &k2}}) &&
+                  stage(k4, {{a41, &k1}, {a42, &k2}, {a43, &k3}}) &&
+                  stage(k5, {{a51, &k1}, {a52, &k2}, {a53, &k3}, {a54, &k4}}) &&
+                  stage(k6, {{a61, &k1}, {a62, &k2}, {a63, &k3}, {a64, &k4}, {a65, &k5}}) &&
+                  stage(k7, {{b1, &k1}, {b3, &k3}, {b4, &k4}, {b5, &k5}, {b6, &k6}});
+        if (!ok)
+        {
+            // a stage ran into a field-free point (electrode interior): retry shorter, else stop
+            if (h <= min_step)
+                break;
+            h = std::max(0.5 * h, min_step);
+            continue;
+        }
+
+        double error = 0.0;
+        for (int c = 0; c < 3; ++c)
+        {
+            double e = h * (e1 * k1[c] + e3 * k3[c] + e4 * k4[c] + e5 * k5[c] + e6 * k6[c] + e7 * k7[c]);
+            error += e * e;
+        }
+        error = std::sqrt(error);
+        double scale = (error > 0.0) ? 0.9 * std::pow(settings.tolerance / error, 0.2) : 5.0;
+        if (error > settings.tolerance && h > min_step)
+        {
+            h = std::max(h * std::max(scale, 0.2), min_step);
+            continue;
+        }
+
+        // y holds the fifth-order step (the last stage point); walk back onto the free side of an electrode or wall
+        if (trace_blocked(L, box, y[0], y[1], y[2]))
+        {
+            if (h <= min_step)
+                break;
+            h = std::max(0.5 * h, min_step);
+            continue;
+        }
+
+        previous = r;
+        r = y;
+        length += h;
+        points.insert(points.end(), r.begin(), r.end());
+        k1 = k7; // first-same-as-last
+
+        // an equipotential is closed once a step passes its seed (from the third step on, so the
+        // first steps leaving the seed do not count; small loops close as well as big ones)
+        if (settings.plane_axis >= 0 && points.size() >= 9)
+        {
+            std::array<double, 3> step{r[0] - previous[0], r[1] - previous[1], r[2] - previous[2]};
+            std::array<double, 3> to_seed{seed[0] - previous[0], seed[1] - previous[1], seed[2] - previous[2]};
+            double step2 = step[0] * step[0] + step[1] * step[1] + step[2] * step[2];
+            double t = (to_seed[0] * step[0] + to_seed[1] * step[1] + to_seed[2] * step[2]) / step2;
+            double gap2 = 0.0;
+            for (int c = 0; c < 3; ++c)
+                gap2 += (to_seed[c] - t * step[c]) * (to_seed[c] - t * step[c]);
+            if (t >= 0.0 && t <= 1.0 && gap2 < 0.25 * step2)
+            {
+                points.insert(points.end(), seed.begin(), seed.end());
+                return true;
+            }
+        }
+
+        h = std::min(settings.max_step, h * std::min(scale, 5.0));
+    }
+    return false;
+}
+
+template <class Layout>
+std::vector<Polyline> trace_curves(const Layout &L, const SimulationBox3D &box,
+                                   const std::vector<std::array<double, 3>> &seeds, TraceSettings settings)
+{
+    if (settings.max_step <= 0.0)
+        settings.max_step = std::min({box.dx, box.dy, box.dz});
+    if (settings.max_length <= 0.0)
+        settings.max_length = 4.0 * std::sqrt(box.full_lx * box.full_lx + box.full_ly * box.full_ly + box.lz * box.lz);
+
+    // curves stop where |E| drops to round-off of the strongest field
+    double field_max = 0.0;
+    for (size_t n = 0; n < box.field_x.size(); ++n)
+        field_max = std::max(field_max, std::abs(box.field_x[n]) + std::abs(box.field_y[n]) + std::abs(box.field_z[n]));
+    double field_floor = 1e-12 * field_max;
+
+    std::vector<Polyline> curves(seeds.size());
+    parallel_for(0, static_cast<int>(seeds.size()), [&](int first, int last)
+    {
+        for (int n = first; n < last; ++n)
+        {
+            const std::array<double, 3> &seed = seeds[n];
+            Polyline &curve = curves[n];
+            if (trace_blocked(L, box, seed[0], seed[1], seed[2]))
+                continue;
+            curve.value = interpolated_potential(L, box, seed[0], seed[1], seed[2]);
+
+            std::vector<double> forward, backward;
+            bool closed = false;
+            if (settings.direction >= 0)
+                closed = trace_branch(L, box, settings, field_floor, seed, 1.0, forward);
+            if (settings.direction <= 0 && !closed)
+                trace_branch(L, box, settings, field_floor, seed, -1.0, backward);
+
+            // backward branch reversed, the seed, then the forward branch
+            curve.points.reserve(backward.size() + 3 + forward.size());
+            for (size_t v = backward.size(); v >= 3; v -= 3)
+                curve.points.insert(curve.points.end(), backward.begin() + (v - 3), backward.begin() + v);
+            curve.points.insert(curve.points.end(), seed.begin(), seed.end());
+            curve.points.insert(curve.points.end(), forward.begin(), forward.end());
+        }
+    });
+
+    // seeds inside electrodes or without field give no curve
+    curves.erase(std::remove_if(curves.begin(), curves.end(), [](const Polyline &curve) { return curve.points.size() < 6; }),
+                 curves.end());
+    return curves;
+}
+
+std::vector<Polyline> trace_curves(const SimulationBox3D &box, const std::vector<std::array<double, 3>> &seeds,
+                                   const TraceSettings &settings)
+{
+    if (box.field_x.size() != box.potential.size())
+        throw std::runtime_error("E field not computed: call computeField() after solving");
+    if (settings.interpolation == FieldInterpolation::Bspline && box.spline_coefficients.size() != box.potential.size())
+        throw std::runtime_error("B-spline not computed: call computeSplineCoefficients() after solving");
+    if (box.brick_storage)
+        return trace_curves(box.brick_layout, box, seeds, settings);
+    return trace_curves(RowMajorLayout(box.nx, box.ny, box.nz), box, seeds, settings);
+}
+
+// Seeds from the "trace" config: explicit "seeds" [[x, y, z], ...] and/or "seed_count" points evenly
+// spaced from "seed_from" to "seed_to" (cm)
+std::vector<std::array<double, 3>> trace_seeds_from_json(const json &trace)
+{
+    std::vector<std::array<double, 3>> seeds;
+    for (const auto &seed : trace.value("seeds", json::array()))
+        seeds.push_back({seed.at(0).get<double>() * cm, seed.at(1).get<double>() * cm, seed.at(2).get<double>() * cm});
+
+    int count = trace.value("seed_count", 0);
+    if (count > 0)
+    {
+        std::array<double, 3> from = trace.at("seed_from").get<std::array<double, 3>>();
+        std::array<double, 3> to = trace.at("seed_to").get<std::array<double, 3>>();
+        for (int n = 0; n < count; ++n)
+        {
+            double t = (count > 1) ? static_cast<double>(n) / (count - 1) : 0.5;
+            seeds.push_back({(from[0] + t * (to[0] - from[0])) * cm,
+                             (from[1] + t * (to[1] - from[1])) * cm,
+                             (from[2] + t * (to[2] - from[2])) * cm});
+        }
+    }
+    return seeds;
+}
 
-        // Position update
-        p.x += p.vx * dt;
-        p.y += p.vy * dt;
-        p.z += p.vz * dt;
+// Binary polylines for the viewers, all little-endian:
+//   PolylineHeader, uint64 offsets[n_lines + 1] (vertex index where each curve starts),
+//   float32 values[n_lines] (potential at the seed), float32 xyz[n_points][3] (m)
+// A closed curve repeats its first vertex at the end.
+struct PolylineHeader
+{
+    char magic[8];            // "POLYLNv1"
+    std::uint32_t n_lines;
+    std::uint32_t kind;       // 0 field lines, 1 equipotentials
+    std::uint64_t n_points;
+};
 
-        // Save trajectory
-        p.posx.push_back(p.x);
-        p.posy.push_back(p.y);
-        p.posz.push_back(p.z);
+void save_polylines(const std::vector<Polyline> &curves, std::uint32_t kind, const std::string &filename)
+{
+    PolylineHeader header{};
+    std::memcpy(header.magic, "POLYLNv1", 8);
+    header.n_lines = static_cast<std::uint32_t>(curves.size());
+    header.kind = kind;
+
+    std::vector<std::uint64_t> offsets(1, 0);
+    std::vector<float> values, xyz;
+    for (const Polyline &curve : curves)
+    {
+        offsets.push_back(offsets.back() + curve.points.size() / 3);
+        values.push_back(static_cast<float>(curve.value));
+        for (double v : curve.points)
+            xyz.push_back(static_cast<float>(v));
     }
+    header.n_points = offsets.back();
 
-    // Final stats
-    p.v = std::sqrt(p.vx * p.vx + p.vy * p.vy + p.vz * p.vz);
-    p.energy = 0.5 * p.m * p.v * p.v;
+    std::ofstream outFile(filename, std::ios::binary);
+    if (!outFile)
+    {
+        std::cerr << "Error: Could not open file \"" << filename << "\" for writing.\n";
+        return;
+    }
+    outFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    outFile.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(std::uint64_t));
+    outFile.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(float));
+    outFile.write(reinterpret_cast<const char *>(xyz.data()), xyz.size() * sizeof(float));
 }
 
 
@@ -1009,6 +1283,107 @@ void double_vector_save_txt(const std::vector<double> &data, const std::string &
     outFile.close();
 }
 
+// Writes the precomputed E field (V/m) as a float32 .npy array of shape (nx', ny', nz', 3), keeping
+// every stride-th node along each axis and unfolding mirrored halves, so viewers np.load it directly
+// (mmap_mode="r" for zero-copy) and draw exactly the field the particles see
+void save_field_npy(const SimulationBox3D &box, int stride, const std::string &filename)
+{
+    stride = std::max(stride, 1);
+    int sx = (box.full_nx + stride - 1) / stride;
+    int sy = (box.full_ny + stride - 1) / stride;
+    int sz = (box.nz + stride - 1) / stride;
+
+    std::vector<float> values(static_cast<size_t>(sx) * sy * sz * 3);
+    parallel_for(0, sx, [&](int first, int last)
+    {
+        for (int a = first; a < last; ++a)
+            for (int b = 0; b < sy; ++b)
+                for (int c = 0; c < sz; ++c)
+                {
+                    // nodes of the mirrored half read their image, with the normal component flipped
+                    int i = a * stride, j = b * stride, k = c * stride;
+                    double flip_x, flip_y;
+                    box.foldIndex(i, j, &flip_x, &flip_y);
+                    int idx = box.index(i, j, k);
+                    float *out = &values[((static_cast<size_t>(a) * sy + b) * sz + c) * 3];
+                    out[0] = static_cast<float>(flip_x * box.field_x[idx]);
+                    out[1] = static_cast<float>(flip_y * box.field_y[idx]);
+                    out[2] = static_cast<float>(box.field_z[idx]);
+                }
+    });
+
+    // .npy version 1.0: magic, header length, then a dict literal padded to a multiple of 64 bytes
+    std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': (" + std::to_string(sx) + ", " +
+                         std::to_string(sy) + ", " + std::to_string(sz) + ", 3), }";
+    size_t total = 10 + header.size() + 1;
+    header.append((64 - total % 64) % 64, ' ');
+    header += '\n';
+
+    std::ofstream outFile(filename, std::ios::binary);
+    if (!outFile)
+    {
+        std::cerr << "Error: Could not open file \"" << filename << "\" for writing.\n";
+        return;
+    }
+    std::uint16_t header_length = static_cast<std::uint16_t>(header.size());
+    outFile.write("\x93NUMPY\x01\x00", 8);
+    outFile.put(static_cast<char>(header_length & 0xff));
+    outFile.put(static_cast<char>(header_length >> 8));
+    outFile << header;
+    outFile.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(float));
+}
+
+// "nearest" | "trilinear" | "bspline"
+FieldInterpolation field_interpolation_from_name(const std::string &name)
+{
+    if (name == "nearest")
+        return FieldInterpolation::Nearest;
+    if (name == "trilinear")
+        return FieldInterpolation::Trilinear;
+    if (name == "bspline")
+        return FieldInterpolation::Bspline;
+    throw std::runtime_error("Unknown interpolation: " + name);
+}
+
+// Field probe for external tools (--probe): points.bin holds float64 x y z (m) per point, fields.bin
+// gets float64 phi (V) Ex Ey Ez (V/m) per point in the same order, NaN outside the box
+// (np.fromfile("fields.bin", "<f8").reshape(-1, 4)). The points file is memory-mapped.
+void probe_file(const SimulationBox3D &box, FieldInterpolation interpolation,
+                const std::string &in_path, const std::string &out_path)
+{
+    MappedFile file(in_path);
+    if (!file.valid() || file.size() % (3 * sizeof(double)) != 0)
+        throw std::runtime_error("Not a probe point file (float64 x y z per point): " + in_path);
+    size_t n = file.size() / (3 * sizeof(double));
+
+    auto probe_start = std::chrono::steady_clock::now();
+    std::vector<double> x(n), y(n), z(n), phi(n), Ex(n), Ey(n), Ez(n);
+    const char *points = reinterpret_cast<const char *>(file.data());
+    for (size_t p = 0; p < n; ++p)
+    {
+        double xyz[3];
+        std::memcpy(xyz, points + 3 * sizeof(double) * p, sizeof(xyz));
+        x[p] = xyz[0];
+        y[p] = xyz[1];
+        z[p] = xyz[2];
+    }
+    box.probe(n, x.data(), y.data(), z.data(), interpolation, phi.data(), Ex.data(), Ey.data(), Ez.data());
+
+    std::vector<double> out(4 * n);
+    for (size_t p = 0; p < n; ++p)
+    {
+        out[4 * p] = phi[p];
+        out[4 * p + 1] = Ex[p];
+        out[4 * p + 2] = Ey[p];
+        out[4 * p + 3] = Ez[p];
+    }
+    std::ofstream outFile(out_path, std::ios::binary);
+    if (!outFile)
+        throw std::runtime_error("Could not open file \"" + out_path + "\" for writing");
+    outFile.write(reinterpret_cast<const char *>(out.data()), out.size() * sizeof(double));
+    std::cout << "Probed " << n << " points in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - probe_start).count() << " s" << std::endl;
+}
 
 // save 1d 3 double vectors of a 3d array
 void save_xyz_to_txt(const std::vector<double> &x,
@@ -1050,6 +1425,260 @@ std::tuple<double, double, double> normalize_vector(double vx, double vy, double
     return {vx / norm, vy / norm, vz / norm};
 }
 
+/*
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+                                        INCREMENTAL RE-SOLVE CACHE
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////
+*/
+
+// incremental_cache.json keeps the grid, the electrode entries of the previous run, a hash of the
+// mesh files each entry imports and the index bounds of the cells it labelled; incremental_cache.bin
+// the row-major potential, geometry, fixed mask and labels it produced
+const std::string incremental_cache_json = "incremental_cache.json";
+const std::string incremental_cache_bin = "incremental_cache.bin";
+
+void save_incremental_cache(const SimulationBox3D &box,
+                            const json &grid_key,
+                            const std::vector<std::pair<std::string, json>> &electrodes)
+{
+    json cache;
+    cache["grid"] = grid_key;
+    cache["electrodes"] = json::object();
+    cache["meshes"] = json::object();
+    for (const auto &[filename, electrode] : electrodes)
+    {
+        cache["electrodes"][filename] = electrode;
+        cache["meshes"][filename] = hash_mesh_files(electrode);
+    }
+
+    // both files are written next to the cache and renamed over it, the old description removed
+    // first, so an interrupted write leaves no cache rather than a header over a truncated body
+    std::string meta_partial = incremental_cache_json + ".part", data_partial = incremental_cache_bin + ".part";
+    std::ofstream meta(meta_partial);
+    std::ofstream data(data_partial, std::ios::binary);
+    if (!meta || !data)
+    {
+        std::cerr << "Error: Could not write the incremental cache.\n";
+        return;
+    }
+
+    std::vector<double> potential_rm = box.toRowMajor(box.potential);
+    std::vector<double> geometry_rm = box.toRowMajor(box.geometry);
+    std::vector<char> mask_rm(potential_rm.size());
+    std::vector<int> label_rm(potential_rm.size());
+    std::vector<std::array<int, 6>> cells(electrodes.size() + 1, {box.nx, box.ny, box.nz, -1, -1, -1});
+    for (int i = 0; i < box.nx; ++i)
+        for (int j = 0; j < box.ny; ++j)
+            for (int k = 0; k < box.nz; ++k)
+            {
+                int l = box.label[box.index(i, j, k)];
+                mask_rm[(static_cast<size_t>(i) * box.ny + j) * box.nz + k] = box.fixed_mask[box.index(i, j, k)];
+                label_rm[(static_cast<size_t>(i) * box.ny + j) * box.nz + k] = l;
+                if (l > 0 && static_cast<size_t>(l) < cells.size())
+                {
+                    auto &c = cells[l];
+                    c = {std::min(c[0], i), std::min(c[1], j), std::min(c[2], k), std::max(c[3], i), std::max(c[4], j), std::max(c[5], k)};
+                }
+            }
+
+    // the old extent of an entry is read back from here: its JSON alone may import a mesh file
+    // that has been edited since
+    cache["cells"] = json::object();
+    for (size_t n = 0; n < electrodes.size(); ++n)
+        if (cells[n + 1][3] >= 0)
+            cache["cells"][electrodes[n].first] = cells[n + 1];
+
+    data.write(reinterpret_cast<const char *>(potential_rm.data()), potential_rm.size() * sizeof(double));
+    data.write(reinterpret_cast<const char *>(geometry_rm.data()), geometry_rm.size() * sizeof(double));
+    data.write(mask_rm.data(), mask_rm.size());
+    data.write(reinterpret_cast<const char *>(label_rm.data()), label_rm.size() * sizeof(int));
+    meta << cache.dump();
+    data.close();
+    meta.close();
+    if (!data || !meta)
+    {
+        std::cerr << "Error: Could not write the incremental cache.\n";
+        return;
+    }
+
+    std::error_code ec;
+    fs::remove(incremental_cache_json, ec);
+    fs::rename(data_partial, incremental_cache_bin, ec);
+    if (!ec)
+        fs::rename(meta_partial, incremental_cache_json, ec);
+    if (ec)
+        std::cerr << "Error: Could not write the incremental cache: " << ec.message() << "\n";
+}
+
+// Loads the previous run and re-rasterizes only the bounding region of the electrodes that were
+// added, removed or edited since then, followed by a residual-driven relaxation that starts from
+// the old potential (or a full solve from it if that does not settle within max_iter sweeps of the
+// patched region). Returns false (full rasterize + solve needed) if there is no usable cache.
+bool incremental_update(SimulationBox3D &box,
+                        const json &grid_key,
+                        const std::vector<std::pair<std::string, json>> &electrodes,
+                        int max_iter, const std::string &method)
+{
+    std::ifstream meta(incremental_cache_json);
+    std::ifstream data(incremental_cache_bin, std::ios::binary);
+    if (!meta || !data)
+        return false;
+
+    json cache;
+    try
+    {
+        meta >> cache;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Ignoring unreadable incremental cache: " << e.what() << "\n";
+        return false;
+    }
+    if (!cache.contains("grid") || cache["grid"] != grid_key || !cache.contains("electrodes"))
+        return false;
+
+    size_t n = static_cast<size_t>(box.nx) * box.ny * box.nz;
+    std::vector<double> potential_rm(n), geometry_rm(n);
+    std::vector<char> mask_rm(n);
+    std::vector<int> label_rm(n);
+    data.read(reinterpret_cast<char *>(potential_rm.data()), n * sizeof(double));
+    data.read(reinterpret_cast<char *>(geometry_rm.data()), n * sizeof(double));
+    data.read(mask_rm.data(), n);
+    data.read(reinterpret_cast<char *>(label_rm.data()), n * sizeof(int));
+    if (!data)
+        return false;
+
+    // dirty region = union of the old and new bounds of every changed electrode
+    std::array<double, 3> dirty_lo = {1e300, 1e300, 1e300}, dirty_hi = {-1e300, -1e300, -1e300};
+    bool whole_grid = false;
+    int n_changed = 0;
+    auto grow = [&](const json &electrode)
+    {
+        std::array<double, 3> lo, hi;
+        if (!electrode_bounds(electrode, lo, hi))
+            whole_grid = true;
+        for (int d = 0; d < 3; ++d)
+        {
+            dirty_lo[d] = std::min(dirty_lo[d], lo[d]);
+            dirty_hi[d] = std::max(dirty_hi[d], hi[d]);
+        }
+    };
+
+    // previous extent of an entry: the cells it labelled (none: nothing to clear), or its JSON
+    // bounds for a cache written before those were recorded
+    const json cached_cells = cache.value("cells", json());
+    auto grow_cached = [&](const std::string &filename, const json &electrode)
+    {
+        if (!cached_cells.is_object())
+        {
+            grow(electrode);
+            return;
+        }
+        if (!cached_cells.contains(filename))
+            return;
+        std::array<int, 6> c = cached_cells[filename].get<std::array<int, 6>>();
+        double spacing[3] = {box.dx, box.dy, box.dz};
+        for (int d = 0; d < 3; ++d)
+        {
+            dirty_lo[d] = std::min(dirty_lo[d], c[d] * spacing[d]);
+            dirty_hi[d] = std::max(dirty_hi[d], c[d + 3] * spacing[d]);
+        }
+    };
+
+    // an entry whose JSON is unchanged still counts as edited if a mesh file it imports was
+    const json &cached = cache["electrodes"];
+    const json cached_meshes = cache.value("meshes", json::object());
+    std::vector<std::string> seen;
+    for (const auto &[filename, electrode] : electrodes)
+    {
+        seen.push_back(filename);
+        if (cached.contains(filename) && cached[filename] == electrode && cached_meshes.contains(filename) &&
+            cached_meshes[filename] == hash_mesh_files(electrode))
+            continue;
+        std::cout << "Changed electrode: " << filename << "\n";
+        ++n_changed;
+        grow(electrode);
+        if (cached.contains(filename))
+            grow_cached(filename, cached[filename]);
+    }
+    for (const auto &[filename, electrode] : cached.items())
+    {
+        if (std::find(seen.begin(), seen.end(), filename) != seen.end())
+            continue;
+        std::cout << "Removed electrode: " << filename << "\n";
+        ++n_changed;
+        grow_cached(filename, electrode);
+    }
+
+    box.potential = box.fromRowMajor(potential_rm);
+    box.geometry = box.fromRowMajor(geometry_rm);
+    for (int i = 0; i < box.nx; ++i)
+        for (int j = 0; j < box.ny; ++j)
+            for (int k = 0; k < box.nz; ++k)
+            {
+                box.fixed_mask[box.index(i, j, k)] = mask_rm[(static_cast<size_t>(i) * box.ny + j) * box.nz + k];
+                box.label[box.index(i, j, k)] = label_rm[(static_cast<size_t>(i) * box.ny + j) * box.nz + k];
+            }
+
+    std::cout << "Incremental mode: " << n_changed << " changed electrode(s)" << std::endl;
+    if (n_changed == 0)
+        return true;
+
+    // index window of the dirty region, one cell of margin for the staircase rounding
+    int lo_idx[3], hi_idx[3];
+    int n_cells[3] = {box.nx, box.ny, box.nz};
+    double spacing[3] = {box.dx, box.dy, box.dz};
+    for (int d = 0; d < 3; ++d)
+    {
+        if (whole_grid)
+        {
+            lo_idx[d] = 0;
+            hi_idx[d] = n_cells[d] - 1;
+            continue;
+        }
+        lo_idx[d] = std::max(0, static_cast<int>(std::floor(dirty_lo[d] / spacing[d])) - 1);
+        hi_idx[d] = std::min(n_cells[d] - 1, static_cast<int>(std::ceil(dirty_hi[d] / spacing[d])) + 1);
+    }
+    if (lo_idx[0] > hi_idx[0] || lo_idx[1] > hi_idx[1] || lo_idx[2] > hi_idx[2])
+        return true; // changes lie entirely outside the grid
+
+    // clear the window and re-rasterize every electrode inside it in file order
+    for (int i = lo_idx[0]; i <= hi_idx[0]; ++i)
+        for (int j = lo_idx[1]; j <= hi_idx[1]; ++j)
+            for (int k = lo_idx[2]; k <= hi_idx[2]; ++k)
+            {
+                int idx = box.index(i, j, k);
+                box.geometry[idx] = box.potential_offset;
+                box.fixed_mask[idx] = false;
+                box.label[idx] = 0;
+            }
+
+    box.setWindow(lo_idx[0], hi_idx[0], lo_idx[1], hi_idx[1], lo_idx[2], hi_idx[2]);
+    box.rasterize(electrodes_from_json(electrodes));
+    box.resetWindow();
+
+    double tol = max_AbsoluteValue_double_vector(box.geometry) * 0.001;
+    long long window_cells = 1;
+    for (int d = 0; d < 3; ++d)
+        window_cells *= hi_idx[d] - lo_idx[d] + 3;
+    long long updates = 0;
+    bool converged = box.relaxLocal(lo_idx[0], hi_idx[0], lo_idx[1], hi_idx[1], lo_idx[2], hi_idx[2], tol,
+                                    max_iter * window_cells, updates);
+    if (converged)
+        std::cout << "Local relaxation converged after " << updates << " cell updates" << std::endl;
+    else
+    {
+        // the change reaches well beyond its window; the sweeps handle that faster than the work list
+        std::cout << "Local relaxation not converged after " << updates << " cell updates, solving the whole grid" << std::endl;
+        box.solve(max_iter, tol, method);
+    }
+    return true;
+}
+
 /*
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1060,10 +1689,26 @@ std::tuple<double, double, double> normalize_vector(double vx, double vy, double
 //////////////////////////////////////////////////////////////////////////////////////////////////////////
 */
 
-int main()
+int main(int argc, char *argv[])
 {
     try
     {
+        // "--probe points.bin fields.bin": solve as usual, then answer the point queries instead of
+        // writing the text outputs and pushing particles
+        std::string probe_in, probe_out;
+        for (int a = 1; a < argc; ++a)
+        {
+            std::string arg = argv[a];
+            if (arg == "--probe" && a + 2 < argc)
+            {
+                probe_in = argv[++a];
+                probe_out = argv[++a];
+            }
+            else
+                throw std::runtime_error("Usage: solve_simulation [--probe points.bin fields.bin]");
+        }
+        bool probe_mode = !probe_in.empty();
+
         std::string configPath = "config.json";
         std::ifstream configFile(configPath);
         if (!configFile.is_open())
@@ -1084,188 +1729,178 @@ int main()
         Bx = config.value("Bx", 1.0);
         By = config.value("By", 1.0);
         Bz = config.value("Bz", 1.0);
+
+        // Optional B field map (.bin, or .csv converted once) added to the uniform field
+        std::string b_map_file = config.value("B_map", "");
+        if (!b_map_file.empty())
+        {
+            B_map = load_b_map(b_map_file);
+            const BMapHeader &g = B_map->grid();
+            std::cout << "B field map: " << g.nx << " x " << g.ny << " x " << g.nz << " nodes" << std::endl;
+        }
         std::string method = config.value("method", "jacobi");
         int max_iter = config.value("max_iter", 1000);
 
-        SimulationBox3D box(nx, ny, nz, lx*cm, ly*cm, lz*cm);
-
-        for (const auto &entry : fs::directory_iterator("."))
+        // Space charge (PIC) loop: deposit -> warm-started re-solve -> push
+        bool space_charge = config.value("space_charge", false);
+        int pic_iterations = config.value("pic_iterations", 10);
+        int pic_smoother_cycles = config.value("pic_smoother_cycles", 5);
+        double pic_relaxation = config.value("pic_relaxation", 0.5);
+
+        // Storage layout: "row-major", "brick" or "auto" (bricks once the grid outgrows the TLB reach)
+        std::string layout = config.value("layout", "row-major");
+        long long brick_min_cells = config.value("brick_min_cells", 128LL * 128 * 128);
+        if (layout == "auto")
+            layout = (static_cast<long long>(nx) * ny * nz >= brick_min_cells) ? "brick" : "row-major";
+
+        // Incremental mode: diff the electrode files against the previous run and only re-solve locally
+        bool incremental = config.value("incremental", false);
+
+        // Electrode boundaries: "staircase" (whole cells), "shortley-weller" (stencils cut at the
+        // signed-distance surface, second order at the boundary) or "partial-volume" (the same cut
+        // stencils, each arm ending at 3/2 - f - g cells from the sub-sampled volume fractions f, g
+        // of the free cell and its electrode neighbour)
+        std::string boundary_treatment = config.value("boundary_treatment", "staircase");
+        int partial_volume_samples = config.value("partial_volume_samples", 4);
+        if (boundary_treatment != "staircase" && boundary_treatment != "shortley-weller" &&
+            boundary_treatment != "partial-volume")
+            throw std::runtime_error("Unknown boundary treatment: " + boundary_treatment);
+        if (incremental && boundary_treatment != "staircase")
         {
-            fs::path filepath = entry.path();
-            std::string filename = filepath.filename().string();
-
-            if (filepath.extension() == ".json" &&
-                filename.rfind("ElectrodeConfig_", 0) == 0)
-            {
-                std::ifstream file(filepath);
-                if (!file.is_open())
-                {
-                    std::cerr << "Failed to open: " << filename << "\n";
-                    continue;
-                }
-
-                json j;
-                try
-                {
-                    file >> j;
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << "JSON parsing error in " << filename << ": " << e.what() << "\n";
-                    continue;
-                }
-
-                if (!j.contains("electrodes") || !j["electrodes"].is_array() || j["electrodes"].empty())
-                {
-                    std::cerr << "Invalid or missing 'electrodes' in " << filename << "\n";
-                    continue;
-                }
-
-                const auto &electrode = j["electrodes"][0];
-                std::string type = "Unknown";
-                if (electrode.contains("type") && electrode["type"].is_string())
-                {
-                    type = electrode["type"];
-                }
-
-                std::cout << "\nFile: " << filename << "\n";
-                std::cout << "Type: " << type << "\n";
-
-                if (type == "Plate")
-                {
-                    double A = electrode.value("A", 0.0);
-                    double B = electrode.value("B", 0.0);
-                    double C = electrode.value("C", 0.0);
-                    double D = electrode.value("D", 0.0);
-                    double thickness = electrode.value("thickness", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addPlane(A, B, C, D * cm, thickness * cm, potential_val);
-
-                    // cout<<A<<B<<C<<D*cm<<thickness*cm<<potential_val<<endl;
-                }
-
-                else if (type == "Cylinder")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double height = electrode.value("height", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addCylinder(cx*cm, cy*cm, cz*cm, radius*cm, height*cm, axis, potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
-
-                else if (type == "HollowRod")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double height = electrode.value("height", 0.0);
-                    double thickness = electrode.value("thickness", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
+            std::cout << "Incremental mode only supports staircase boundaries, doing a full solve" << std::endl;
+            incremental = false;
+        }
 
-                    box.addHollowPipe(cx*cm,cy*cm,cz*cm,radius*cm,thickness*cm,height*cm,axis,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // Field seen by the particles: "nearest" (field of the enclosing cell), "trilinear" or "bspline"
+        std::string interpolation_name = config.value("interpolation", "nearest");
+        FieldInterpolation interpolation = field_interpolation_from_name(interpolation_name);
 
-                else if (type == "Box")
-                {
-                    double x0 = electrode.value("x0", 0.0);
-                    double y0 = electrode.value("y0", 0.0);
-                    double z0 = electrode.value("z0", 0.0);
-                    double x1 = electrode.value("x1", 0.0);
-                    double y1 = electrode.value("y1", 0.0);
-                    double z1 = electrode.value("z1", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addBox(x0*cm,y0*cm,z0*cm,x1*cm,y1*cm,z1*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // --probe queries read the field with "probe_interpolation" (default: the particles' one)
+        FieldInterpolation probe_interpolation = field_interpolation_from_name(config.value("probe_interpolation", interpolation_name));
 
-                else if (type == "Spherical")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double radius = electrode.value("radius", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addSphere(cx*cm,cy*cm,cz*cm,radius*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // Geometry cache: reuse the labelled grid of an identical scene ("geometry_cache": false to always rasterize)
+        bool geometry_cache = config.value("geometry_cache", true);
 
-                else if (type == "Ellipsoidal")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double rx = electrode.value("rx", 0.0);
-                    double ry = electrode.value("ry", 0.0);
-                    double rz = electrode.value("rz", 0.0);
-                    double potential_val = electrode.value("potential", 0.0);
-
-                    box.addEllipsoid(cx*cm,cy*cm,cz*cm,rx*cm,ry*cm,rz*cm,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // Basis fields: potential of each electrode at 1 V with all others grounded (batched solve)
+        bool basis_fields = config.value("basis_fields", false);
 
-                else if (type == "Hyperboloidal")
-                {
-                    double cx = electrode.value("cx", 0.0);
-                    double cy = electrode.value("cy", 0.0);
-                    double cz = electrode.value("cz", 0.0);
-                    double a = electrode.value("a", 0.0);
-                    double b = electrode.value("b", 0.0);
-                    double c = electrode.value("c", 0.0);
-                    double waist = electrode.value("waist", 0.0);
-                    char axis = 'z';
-                    if (electrode.contains("axis") && electrode["axis"].is_string())
-                    {
-                        std::string axis_str = electrode["axis"];
-                        if (!axis_str.empty())
-                            axis = axis_str[0];
-                    }
-                    double potential_val = electrode.value("potential", 0.0);
+        // Symmetry planes: "symmetry_planes": ["x"] and/or ["y"] meshes only the half below Lx/2 (Ly/2)
+        bool mirror_x = false, mirror_y = false;
+        if (config.contains("symmetry_planes") && config["symmetry_planes"].is_array())
+        {
+            for (const auto &plane : config["symmetry_planes"])
+            {
+                if (plane == "x")
+                    mirror_x = true;
+                else if (plane == "y")
+                    mirror_y = true;
+                else
+                    std::cerr << "Ignoring unsupported symmetry plane " << plane << "\n";
+            }
+        }
+        int box_nx = mirror_x ? (nx + 1) / 2 : nx;
+        int box_ny = mirror_y ? (ny + 1) / 2 : ny;
+        double box_lx = lx * (box_nx - 1) / (nx - 1);
+        double box_ly = ly * (box_ny - 1) / (ny - 1);
+
+        SimulationBox3D box(box_nx, box_ny, nz, box_lx*cm, box_ly*cm, lz*cm);
+        box.setSymmetry(mirror_x, mirror_y, nx, ny);
+        box.setLayout(layout);
+        std::cout << "Grid layout: " << layout << std::endl;
+
+        // Analytic B sources, summed at the particle position at every step or ("B_tabulate": true) sampled
+        // once on the full grid and then interpolated like a field map, the faster choice for many sources
+        B_sources = magnet_sources_from_json(config.value("B_sources", json::array()));
+        if (!B_sources.empty() && config.value("B_tabulate", false))
+        {
+            tabulate_magnet_sources(B_sources, "B_sources.bin", nx, ny, nz, box.dx, box.dy, box.dz);
+            B_sources_map = std::make_unique<MagneticFieldMap>("B_sources.bin");
+            std::cout << "B sources tabulated on " << nx << " x " << ny << " x " << nz << " nodes" << std::endl;
+        }
 
-                    box.addHyperboloid(cx*cm,cy*cm,cz*cm,a*cm,b*cm,c*cm,waist*cm,axis,potential_val);
-                    // cout<<cx*cm<<cy*cm<<cz*cm<<radius*cm<<height*cm<<axis<<potential_val<<endl;
-                }
+        // Electrodes: every entry of every ElectrodeConfig_*.json, or of the "scene_file" if one is given
+        std::vector<std::pair<std::string, json>> electrodes = load_electrode_entries(config.value("scene_file", ""));
 
-                else
-                {
-                    std::cout << "  [!] Unknown electrode type. Skipping parsing.\n";
-                }
+        // Rasterize the electrodes (or patch the cached grid in incremental mode), then solve potential
+        json grid_key = grid_key_json(nx, ny, nz, lx, ly, lz, mirror_x, mirror_y);
+        auto solve_start = std::chrono::steady_clock::now();
+        bool patched = incremental && incremental_update(box, grid_key, electrodes, max_iter, method);
+        if (!patched)
+        {
+            // a geometry_cache.bin left by save_geometry (or the previous run) for the same scene
+            // replaces the rasterization; only the cut-cell treatments need the shapes rebuilt
+            std::uint64_t geometry_key = geometry_hash(grid_key, electrodes);
+            if (!geometry_cache || !load_geometry_cache(box, electrodes, geometry_key, boundary_treatment != "staircase"))
+            {
+                box.rasterize(electrodes_from_json(electrodes));
+                if (geometry_cache)
+                    save_geometry_cache(box, geometry_key);
             }
         }
+        if (boundary_treatment == "shortley-weller")
+        {
+            box.buildCutCells();
+            std::cout << "Shortley-Weller cut cells: " << box.cut_cells.size() << std::endl;
+        }
+        else if (boundary_treatment == "partial-volume")
+        {
+            box.buildPartialVolumes(partial_volume_samples);
+            std::cout << "Partial-volume boundary cells: " << box.cut_cells.size() << std::endl;
+        }
 
-        // Solve potential
         double tol = max_AbsoluteValue_double_vector(box.geometry) * 0.001;
-        box.solve(max_iter, tol, method);
+        if (!patched)
+            box.solve(max_iter, tol, method);
+        std::chrono::duration<double> solve_time = std::chrono::steady_clock::now() - solve_start;
+        std::cout << "Solve time (" << layout << "): " << solve_time.count() << " s" << std::endl;
+
+        if (incremental)
+            save_incremental_cache(box, grid_key, electrodes);
 
         // Save outputs
-        double_vector_save_txt(box.potential, "potential.txt");
-        double_vector_save_txt(box.geometry, "geometry.txt");
+        if (!probe_mode)
+        {
+            double_vector_save_txt(box.unfoldedRowMajor(box.potential), "potential.txt");
+            double_vector_save_txt(box.unfoldedRowMajor(box.geometry), "geometry.txt");
+        }
+
+        if (basis_fields && !electrodes.empty() && !probe_mode)
+        {
+            std::vector<std::vector<double>> unit_voltages(electrodes.size(), std::vector<double>(box.potential.size(), 0.0));
+            for (size_t idx = 0; idx < box.potential.size(); ++idx)
+                if (box.fixed_mask[idx] && box.label[idx] > 0)
+                    unit_voltages[box.label[idx] - 1][idx] = 1.0;
+
+            std::vector<std::vector<double>> basis = box.solveBatch(unit_voltages, max_iter, 0.001);
+            for (size_t n = 0; n < basis.size(); ++n)
+                double_vector_save_txt(box.unfoldedRowMajor(basis[n]), "basis_field_" + std::to_string(n) + ".txt");
+        }
+
 
+        // E = -grad(potential) once for all particles and steps, also saved for the viewers
+        // ("efield_stride": keep every n-th node, 0 = do not write efield.npy)
+        bool spline = interpolation == FieldInterpolation::Bspline ||
+                      (probe_mode && probe_interpolation == FieldInterpolation::Bspline);
+        box.computeField();
+        if (spline)
+            box.computeSplineCoefficients();
+        int efield_stride = probe_mode ? 0 : config.value("efield_stride", 1);
+
+        // Distance to the nearest electrode for swept hit checks ("swept_collisions": true; off by
+        // default, so tracks keep ending at the first step that lands in an electrode cell rather than
+        // at the hit point found along the step) and "max_step_multiplier" > 1 to merge steps far
+        // from the electrodes
+        bool swept_collisions = config.value("swept_collisions", false);
+        int max_step_multiplier = config.value("max_step_multiplier", 1);
+        if (swept_collisions && !probe_mode)
+            box.computeElectrodeDistance();
+        else if (max_step_multiplier > 1 && !probe_mode)
+            std::cerr << "max_step_multiplier needs swept_collisions, ignoring it\n";
+        if (efield_stride > 0)
+            save_field_npy(box, efield_stride, "efield.npy");
 
         // Add particles
-        int particle_iterator = 0;
+        std::vector<ParticleRun> ensemble;
         for (const auto &entry : fs::directory_iterator("."))
         {
             fs::path filepath = entry.path();
@@ -1346,11 +1981,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "Electron")
@@ -1390,11 +2021,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C1")
@@ -1434,11 +2061,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C2")
@@ -1478,11 +2101,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C3")
@@ -1522,11 +2141,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C4")
@@ -1566,11 +2181,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C5")
@@ -1610,11 +2221,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "C6")
@@ -1654,11 +2261,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O1")
@@ -1698,11 +2301,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O2")
@@ -1742,11 +2341,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O3")
@@ -1786,11 +2381,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O4")
@@ -1830,11 +2421,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O5")
@@ -1874,11 +2461,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O6")
@@ -1918,11 +2501,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O7")
@@ -1962,11 +2541,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "O8")
@@ -2006,11 +2581,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else if (type == "Custom")
@@ -2050,11 +2621,7 @@ int main()
                     double dt = t_max / t_res;
 
                     Particle p = Particle::__init__{.x = x, .y = y, .z = z, .vx = vx, .vy = vy, .vz = vz, .q = q, .m = m}.__build__();
-                    propagator(p, box, t_max, dt);
-
-                    std::string filename = "particle_track_" + std::to_string(particle_iterator++) + ".txt";
-                    save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
-                    particle_iterator += 1;
+                    ensemble.push_back({p, t_max, dt, particle.value("current", 0.0)});
                 }
 
                 else
@@ -2065,6 +2632,103 @@ int main()
             }
         }
 
+        if (space_charge)
+        {
+            box.enablePoisson();
+            std::vector<double> rho(box.potential.size());
+
+            for (int pic_iter = 0; pic_iter < pic_iterations; ++pic_iter)
+            {
+                std::fill(rho.begin(), rho.end(), 0.0);
+                for (const ParticleRun &run : ensemble)
+                {
+                    Particle p = run.initial;
+                    propagator(p, box, run.t_max, run.dt, &rho, run.current, interpolation, max_step_multiplier);
+                }
+
+                // under-relaxed charge update keeps the trajectory iteration stable
+                for (size_t n = 0; n < rho.size(); ++n)
+                    box.charge_density[n] = (1.0 - pic_relaxation) * box.charge_density[n] + pic_relaxation * rho[n];
+
+                // the previous potential is the initial guess, so a few sweeps are enough per outer iteration
+                std::cout << "\nSpace charge iteration " << pic_iter << std::endl;
+                box.solve(pic_smoother_cycles, tol, method);
+                box.computeField();
+                if (spline)
+                    box.computeSplineCoefficients();
+            }
+
+            if (!probe_mode)
+            {
+                double_vector_save_txt(box.unfoldedRowMajor(box.potential), "potential.txt");
+                double_vector_save_txt(box.unfoldedRowMajor(box.charge_density), "charge_density.txt");
+            }
+            if (efield_stride > 0)
+                save_field_npy(box, efield_stride, "efield.npy");
+        }
+
+        if (probe_mode)
+        {
+            probe_file(box, probe_interpolation, probe_in, probe_out);
+            return 0;
+        }
+
+        // Field lines or equipotential contours from seed points, on the final field:
+        // "trace": {"type": "field_lines" | "equipotentials", "seeds": [[x, y, z], ...] and/or
+        //           "seed_from", "seed_to", "seed_count" (cm), "plane": "x" | "y" | "z" (equipotentials),
+        //           "direction": "both" | "forward" | "backward", "tolerance", "max_step", "max_length" (cm),
+        //           "max_points"}
+        // The nearest-cell field is piecewise constant, so tracing reads it trilinearly in that case.
+        if (config.contains("trace"))
+        {
+            const json &trace = config["trace"];
+            std::string type = trace.value("type", "field_lines");
+            TraceSettings settings;
+            settings.interpolation = (interpolation == FieldInterpolation::Nearest) ? FieldInterpolation::Trilinear : interpolation;
+            if (type == "equipotentials")
+            {
+                std::string plane = trace.value("plane", "z");
+                if (plane != "x" && plane != "y" && plane != "z")
+                    throw std::runtime_error("Unknown trace plane: " + plane);
+                settings.plane_axis = plane[0] - 'x';
+            }
+            else if (type != "field_lines")
+                throw std::runtime_error("Unknown trace type: " + type);
+
+            std::string direction = trace.value("direction", "both");
+            if (direction == "forward")
+                settings.direction = 1;
+            else if (direction == "backward")
+                settings.direction = -1;
+            else if (direction != "both")
+                throw std::runtime_error("Unknown trace direction: " + direction);
+
+            settings.tolerance = trace.value("tolerance", 1e-4) * cm;
+            settings.max_step = trace.value("max_step", 0.0) * cm;
+            settings.max_length = trace.value("max_length", 0.0) * cm;
+            settings.max_points = trace.value("max_points", 20000);
+
+            std::vector<std::array<double, 3>> seeds = trace_seeds_from_json(trace);
+            auto trace_start = std::chrono::steady_clock::now();
+            std::vector<Polyline> curves = trace_curves(box, seeds, settings);
+            size_t n_points = 0;
+            for (const Polyline &curve : curves)
+                n_points += curve.points.size() / 3;
+            std::cout << "\nTraced " << curves.size() << " of " << seeds.size() << " "
+                      << (settings.plane_axis >= 0 ? "equipotentials" : "field lines") << " (" << n_points << " points) in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - trace_start).count() << " s" << std::endl;
+            save_polylines(curves, settings.plane_axis >= 0 ? 1 : 0, "traced_curves.bin");
+        }
+
+        for (size_t n = 0; n < ensemble.size(); ++n)
+        {
+            Particle p = ensemble[n].initial;
+            propagator(p, box, ensemble[n].t_max, ensemble[n].dt, nullptr, 0.0, interpolation, max_step_multiplier);
+
+            std::string filename = "particle_track_" + std::to_string(n) + ".txt";
+            save_xyz_to_txt(p.posx, p.posy, p.posz, filename);
+        }
+
         return 0;
     }
     catch (const std::exception &e)